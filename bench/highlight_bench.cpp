@@ -0,0 +1,266 @@
+// Syntax highlighting throughput on large C/C++ sources.
+//
+//   highlight-bench [file...]
+//
+// Highlights every line of the given files (or a synthetic 64 MiB C++ file)
+// with the "c" syntax and reports MB/s. Keyword lookups are also timed on
+// their own, the perfect hash against a linear scan over the keyword list.
+// The memory the highlight takes as runs is compared with one byte per
+// character, and so is composing every line into a screen from either. The two
+// are composed in alternating rounds, so a busy machine slows both alike.
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "screen.h"
+#include "syntax.h"
+
+namespace
+{
+
+std::string makeSource(std::size_t size)
+{
+    const std::string_view snippet = R"(/* a block comment
+ * spanning a few lines */
+static int parseHeader(const char* buf, unsigned long length)
+{
+    // walk the buffer looking for the terminator
+    for (int i = 0; i < length; ++i)
+    {
+        if (buf[i] == '\n' && i + 1 < length)
+            return i * 2 + 0x1f;
+        else if (buf[i] == '"')
+            continue;
+    }
+    double ratio = 3.25 * length;
+    return (int)ratio;
+}
+
+class Parser
+{
+    struct State { long offset; char last; };
+    switch (mode) { case 1: break; default: return "unterminated \"string\""; }
+};
+)";
+
+    std::string data;
+    data.reserve(size + snippet.size());
+    while (data.size() < size)
+    {
+        data += snippet;
+    }
+    return data;
+}
+
+std::vector<std::string_view> splitLines(std::string_view data)
+{
+    std::vector<std::string_view> lines;
+    for (std::size_t start{0}; start < data.size();)
+    {
+        std::size_t end = data.find('\n', start);
+        if (end == std::string_view::npos)
+            end = data.size();
+        lines.push_back(data.substr(start, end - start));
+        start = end + 1;
+    }
+    return lines;
+}
+
+template <typename F> double timeOnce(F&& f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+template <typename F> double bestOf(F&& f)
+{
+    double best{1e30};
+    for (int run{0}; run < 5; ++run)
+    {
+        best = std::min(best, timeOnce(f));
+    }
+    return best;
+}
+
+// the best times of f and g, run one after the other in each round
+template <typename F, typename G> std::pair<double, double> bestOfAlternating(F&& f, G&& g)
+{
+    std::pair<double, double> best{1e30, 1e30};
+    for (int run{0}; run < 9; ++run)
+    {
+        best.first = std::min(best.first, timeOnce(f));
+        best.second = std::min(best.second, timeOnce(g));
+    }
+    return best;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    std::string data;
+    for (int i{1}; i < argc; ++i)
+    {
+        std::ifstream in{argv[i], std::ios::binary};
+        std::stringstream contents;
+        contents << in.rdbuf();
+        data += contents.str();
+    }
+    if (data.empty())
+        data = makeSource(64u << 20);
+
+    const EditorSyntax* syntax{nullptr};
+    for (const EditorSyntax& candidate : syntaxDatabase())
+    {
+        if (candidate.filetype == "c")
+            syntax = &candidate;
+    }
+    if (!syntax)
+        return 1;
+
+    std::vector<std::string_view> lines = splitLines(data);
+    std::printf("%zu MiB, %zu lines\n", data.size() >> 20, lines.size());
+
+    HighlightRuns highlight;
+    std::size_t keywordChars{0};
+    double seconds = bestOf([&] {
+        int state{HL_STATE_NORMAL};
+        keywordChars = 0;
+        for (std::string_view line : lines)
+        {
+            state = syntaxHighlightLine(*syntax, line, state, highlight);
+            for (const HighlightRun& run : highlight)
+            {
+                if (run.hl == HL_KEYWORD1 || run.hl == HL_KEYWORD2)
+                    keywordChars += run.length;
+            }
+        }
+    });
+    std::printf("  full highlight           %8.1f MB/s  (%zu keyword chars)\n", data.size() / seconds / 1e6,
+                keywordChars);
+
+    // every row's highlight both ways, as the editor would hold them
+    std::vector<HighlightRuns> runs(lines.size());
+    std::vector<std::string> bytes(lines.size());
+    std::size_t runBytes{0};
+    std::size_t byteBytes{0};
+    int state{HL_STATE_NORMAL};
+    for (std::size_t i{0}; i < lines.size(); ++i)
+    {
+        state = syntaxHighlightLine(*syntax, lines[i], state, runs[i]);
+        runs[i].shrink_to_fit();
+        bytes[i].assign(lines[i].size(), HL_NORMAL);
+        for (const HighlightRun& run : runs[i])
+        {
+            std::fill_n(bytes[i].begin() + run.start, run.length, static_cast<char>(run.hl));
+        }
+
+        runBytes += sizeof(HighlightRuns) + runs[i].capacity() * sizeof(HighlightRun);
+        // the string's own buffer only once it outgrows the small string one
+        byteBytes += sizeof(std::string) + (bytes[i].capacity() > 15 ? bytes[i].capacity() + 1 : 0);
+    }
+    std::printf("  highlight memory           %6.1f MiB as runs, %.1f MiB as bytes\n", runBytes / 1048576.0,
+                byteBytes / 1048576.0);
+
+    // compose each line into one screen row, 200 columns wide
+    Screen screen;
+    screen.resize(1, 200);
+    auto composeBytes = [&] {
+        for (std::size_t i{0}; i < lines.size(); ++i)
+        {
+            std::string_view text = lines[i].substr(0, 200);
+            const std::string& hl = bytes[i];
+            screen.clearRow(0);
+            for (std::size_t j{0}; j < text.size();)
+            {
+                std::size_t end = j + 1;
+                while (end < text.size() && hl[end] == hl[j])
+                {
+                    ++end;
+                }
+                screen.put(0, j, text.substr(j, end - j), Attr{static_cast<std::uint8_t>(hl[j])});
+                j = end;
+            }
+        }
+    };
+    auto composeRuns = [&] {
+        for (std::size_t i{0}; i < lines.size(); ++i)
+        {
+            std::string_view text = lines[i].substr(0, 200);
+            screen.clearRow(0);
+            std::size_t x{0};
+            for (const HighlightRun& run : runs[i])
+            {
+                if (run.start >= text.size())
+                    break;
+                screen.put(0, x, text.substr(x, run.start - x));
+                screen.put(0, run.start, text.substr(run.start, run.length), Attr{static_cast<std::uint8_t>(run.hl)});
+                x = std::min<std::size_t>(run.start + run.length, text.size());
+            }
+            screen.put(0, x, text.substr(x));
+        }
+    };
+    auto [bytesSeconds, runsSeconds] = bestOfAlternating(composeBytes, composeRuns);
+    std::printf("  compose from bytes       %8.1f M lines/s\n", lines.size() / bytesSeconds / 1e6);
+    std::printf("  compose from runs        %8.1f M lines/s\n", lines.size() / runsSeconds / 1e6);
+
+    // every identifier in the input, looked up on its own
+    std::vector<std::string_view> identifiers;
+    for (std::size_t i{0}; i < data.size();)
+    {
+        if (!std::isalpha(static_cast<unsigned char>(data[i])) && data[i] != '_')
+        {
+            ++i;
+            continue;
+        }
+        std::size_t end = i + 1;
+        while (end < data.size() && (std::isalnum(static_cast<unsigned char>(data[end])) || data[end] == '_'))
+        {
+            ++end;
+        }
+        identifiers.push_back(std::string_view{data}.substr(i, end - i));
+        i = end;
+    }
+
+    std::size_t hits{0};
+    seconds = bestOf([&] {
+        hits = 0;
+        for (std::string_view word : identifiers)
+        {
+            hits += syntax->tables->keywords().lookup(word) != KeywordTable::KEYWORD_NONE;
+        }
+    });
+    std::printf("  perfect hash lookup      %8.1f M identifiers/s  (%zu keywords)\n",
+                identifiers.size() / seconds / 1e6, hits);
+
+    seconds = bestOf([&] {
+        hits = 0;
+        for (std::string_view word : identifiers)
+        {
+            for (std::string_view keyword : syntax->keywords)
+            {
+                if (keyword.ends_with('|'))
+                    keyword.remove_suffix(1);
+                if (keyword == word)
+                {
+                    ++hits;
+                    break;
+                }
+            }
+        }
+    });
+    std::printf("  linear keyword scan      %8.1f M identifiers/s  (%zu keywords)\n",
+                identifiers.size() / seconds / 1e6, hits);
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+// Line index build throughput on synthetic files.
+//
+//   lineindex-bench [size in MiB]
+//
+// Reports GB/s for every scan kernel the CPU supports, single threaded and on
+// all cores, for LF and CRLF files. A std::getline pass over the same buffer is
+// included as the baseline the editor used to open files with.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lineindex.h"
+
+namespace
+{
+
+std::string makeFile(std::size_t size, bool crlf)
+{
+    std::mt19937 rng{42};
+    std::uniform_int_distribution<int> lineLength{0, 120};
+    std::uniform_int_distribution<int> letter{'a', 'z'};
+
+    std::string data;
+    data.reserve(size + 128);
+    while (data.size() < size)
+    {
+        for (int n = lineLength(rng); n > 0; --n)
+        {
+            data += static_cast<char>(letter(rng));
+        }
+        data += crlf ? "\r\n" : "\n";
+    }
+    return data;
+}
+
+template <typename F> double secondsPerRun(F&& f)
+{
+    // best of a few runs to keep page faults and turbo noise out
+    double best{1e30};
+    for (int run{0}; run < 5; ++run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+void report(const char* name, std::size_t bytes, std::size_t lines, double seconds)
+{
+    std::printf("  %-24s %8.2f GB/s  %10zu lines\n", name, bytes / seconds / 1e9, lines);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    std::size_t size = (argc >= 2 ? std::strtoull(argv[1], nullptr, 10) : 512) << 20;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> threadCounts{1};
+    if (cores > 1)
+        threadCounts.push_back(cores);
+
+    const struct
+    {
+        const char* name;
+        ScanKernel kernel;
+    } kernels[]{{"scalar", ScanKernel::Scalar}, {"sse2", ScanKernel::Sse2}, {"avx2", ScanKernel::Avx2}};
+
+    for (bool crlf : {false, true})
+    {
+        std::string data = makeFile(size, crlf);
+        std::printf("%s, %zu MiB, %u cores\n", crlf ? "CRLF" : "LF", data.size() >> 20, cores);
+
+        std::size_t lines{0};
+        double seconds = secondsPerRun([&] {
+            std::istringstream in{data};
+            lines = 0;
+            for (std::string line; std::getline(in, line);)
+            {
+                ++lines;
+            }
+        });
+        report("std::getline", data.size(), lines, seconds);
+
+        for (const auto& [name, kernel] : kernels)
+        {
+            if (!LineIndex::kernelSupported(kernel))
+                continue;
+
+            for (unsigned threads : threadCounts)
+            {
+                seconds = secondsPerRun([&] { lines = LineIndex::build(data, threads, kernel).size(); });
+                std::string label = std::string{name} + (threads == 1 ? ", 1 thread" : ", all cores");
+                report(label.c_str(), data.size(), lines, seconds);
+            }
+        }
+    }
+
+    return 0;
+}
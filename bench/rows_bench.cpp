@@ -0,0 +1,174 @@
+// Row storage layouts compared on a synthetic 2M-line file.
+//
+//   rows-bench [lines]
+//
+// Loads every row into a RowTree the way scrolling through the whole file
+// would, once with row text in plain std::strings and once allocated from a
+// RowArena. Reports heap allocations, resident memory, load time and the time
+// of a full scan over the loaded rows. Each layout runs in its own process so
+// resident memory isn't skewed by the other.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <sys/wait.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+#include "rowarena.h"
+#include "rowtree.h"
+
+namespace
+{
+
+std::size_t heapAllocations{0};
+
+std::string makeFile(std::size_t lines)
+{
+    std::mt19937 rng{42};
+    std::uniform_int_distribution<int> lineLength{0, 100};
+    std::uniform_int_distribution<int> letter{'a', 'z'};
+
+    std::string data;
+    for (std::size_t i{0}; i < lines; ++i)
+    {
+        for (int n = lineLength(rng); n > 0; --n)
+        {
+            data += static_cast<char>(letter(rng));
+        }
+        data += '\n';
+    }
+    return data;
+}
+
+std::vector<std::string_view> splitLines(std::string_view data)
+{
+    std::vector<std::string_view> lines;
+    for (std::size_t start{0}; start < data.size();)
+    {
+        std::size_t end = data.find('\n', start);
+        lines.push_back(data.substr(start, end - start));
+        start = end + 1;
+    }
+    return lines;
+}
+
+std::size_t residentKiB()
+{
+    long pages{0};
+    long resident{0};
+    if (FILE* statm = std::fopen("/proc/self/statm", "r"))
+    {
+        if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        std::fclose(statm);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the editor's row, with chars in the given string type; render stays a
+// std::string as it is empty unless the row has tabs
+template <typename String> struct Row
+{
+    String chars;
+    std::string render;
+};
+
+template <typename String> void measure(const char* name, const std::vector<std::string_view>& lines,
+                                        std::pmr::memory_resource* resource)
+{
+    std::size_t residentBefore = residentKiB();
+    std::size_t allocationsBefore = heapAllocations;
+
+    auto start = std::chrono::steady_clock::now();
+    RowTree<Row<String>> rows;
+    rows.assignSource(lines.size(), [&](std::size_t line) {
+        if constexpr (std::is_same_v<String, std::string>)
+            return Row<String>{String{lines[line]}};
+        else
+            return Row<String>{String{lines[line], resource}};
+    });
+    for (std::size_t i{0}; i < lines.size(); ++i)
+    {
+        rows[i];
+    }
+    double load = secondsSince(start);
+    std::size_t allocations = heapAllocations - allocationsBefore;
+    std::size_t resident = residentKiB() - residentBefore;
+
+    start = std::chrono::steady_clock::now();
+    std::size_t vowels{0};
+    for (int pass{0}; pass < 5; ++pass)
+    {
+        rows.forEachLoaded([&](const Row<String>& row) {
+            for (char c : row.chars)
+            {
+                vowels += c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u';
+            }
+        });
+    }
+    double scan = secondsSince(start) / 5;
+
+    std::printf("  %-8s %10zu allocations  %8.1f MiB resident  load %6.0f ms  scan %6.1f ms  (%zu)\n", name,
+                allocations, resident / 1024.0, load * 1e3, scan * 1e3, vowels);
+}
+
+template <typename F> void inChild(F&& f)
+{
+    std::fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        f();
+        std::fflush(stdout);
+        std::_Exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+}
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    ++heapAllocations;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2'000'000;
+    std::string data = makeFile(count);
+    std::vector<std::string_view> lines = splitLines(data);
+    std::printf("%zu lines, %zu MiB\n", lines.size(), data.size() >> 20);
+
+    inChild([&] { measure<std::string>("heap", lines, nullptr); });
+    inChild([&] {
+        RowArena arena;
+        measure<std::pmr::string>("arena", lines, &arena);
+        std::printf("  arena    %10zu chunks from the system\n", arena.systemAllocations());
+    });
+    return 0;
+}
@@ -0,0 +1,216 @@
+// Search throughput on a synthetic log file.
+//
+//   search-bench [lines in thousands]
+//
+// Reports the time to find the rows containing a query for every search
+// kernel the CPU supports, single threaded and on all cores, with a row by row
+// std::string_view::find pass as the baseline the find prompt used to run.
+// Then times typing a query one character at a time, where every keystroke
+// after the first only rechecks the rows the one before matched. Then builds
+// the trigram index and times the same queries scanning only the blocks it
+// leaves. Then times regex searches, against std::regex for the first. Last
+// times building the rows of a replace all, with a row by row rebuild as the
+// baseline.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lineindex.h"
+#include "regexmatcher.h"
+#include "search.h"
+#include "trigramindex.h"
+
+namespace
+{
+
+std::string makeLog(std::size_t lines)
+{
+    const char* levels[]{"INFO", "DEBUG", "WARN", "ERROR"};
+    const char* words[]{"request", "served", "cache", "miss", "connection", "closed", "retry", "timeout", "user", "session"};
+    std::mt19937 rng{42};
+
+    std::string data;
+    for (std::size_t i{0}; i < lines; ++i)
+    {
+        data += "2024-05-01T12:";
+        data += std::to_string(10 + rng() % 50);
+        data += ' ';
+        data += levels[rng() % 4];
+        for (int n = 4 + rng() % 8; n > 0; --n)
+        {
+            data += ' ';
+            data += words[rng() % 10];
+        }
+        data += " id=" + std::to_string(rng() % 1000000) + '\n';
+    }
+    return data;
+}
+
+template <typename F> double secondsPerRun(F&& f)
+{
+    double best{1e30};
+    for (int run{0}; run < 5; ++run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+void report(const char* name, double seconds, std::size_t rows)
+{
+    std::printf("  %-24s %9.2f ms  %10zu rows\n", name, seconds * 1e3, rows);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    std::size_t lineCount = (argc >= 2 ? std::strtoull(argv[1], nullptr, 10) : 2000) * 1000;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> threadCounts{1};
+    if (cores > 1)
+        threadCounts.push_back(cores);
+
+    std::string data = makeLog(lineCount);
+    LineIndex lines = LineIndex::build(data);
+    std::vector<SearchSpan> spans{{0, static_cast<int>(lines.size()), data, &lines, 0}};
+    std::printf("%zu lines, %zu MiB, %u cores\n", lines.size(), data.size() >> 20, cores);
+
+    const struct
+    {
+        const char* name;
+        SearchKernel kernel;
+    } kernels[]{{"scalar", SearchKernel::Scalar}, {"sse2", SearchKernel::Sse2}, {"avx2", SearchKernel::Avx2}};
+
+    for (const char* query : {"timeout", "id=99999", "ERROR retry"})
+    {
+        std::printf("\"%s\"\n", query);
+
+        std::size_t rows{0};
+        double seconds = secondsPerRun([&] {
+            rows = 0;
+            for (std::size_t i{0}; i < lines.size(); ++i)
+            {
+                rows += lines.line(data, i).find(query) != std::string_view::npos;
+            }
+        });
+        report("string_view::find", seconds, rows);
+
+        for (const auto& [name, kernel] : kernels)
+        {
+            if (!TextSearch::kernelSupported(kernel))
+                continue;
+
+            for (unsigned threads : threadCounts)
+            {
+                TextSearch search;
+                seconds = secondsPerRun([&] {
+                    search.reset(spans);
+                    rows = search.search(query, threads, kernel)->rows.size();
+                });
+                std::string label = std::string{name} + (threads == 1 ? ", 1 thread" : ", all cores");
+                report(label.c_str(), seconds, rows);
+            }
+        }
+    }
+
+    std::printf("typing \"connection closed\"\n");
+    std::string typed{"connection closed"};
+    TextSearch search;
+    search.reset(spans);
+    for (std::size_t length{1}; length <= typed.size(); ++length)
+    {
+        std::string_view query = std::string_view{typed}.substr(0, length);
+        auto start = std::chrono::steady_clock::now();
+        std::size_t rows = search.search(query)->rows.size();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::string label = std::string{"\""} + std::string{query} + '"';
+        report(label.c_str(), elapsed.count(), rows);
+    }
+
+    std::atomic<bool> cancel{false};
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<TrigramIndex> index = TrigramIndex::build(data, lines, cancel);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("trigram index: %.2f ms, %zu trigrams, %zu KiB\n", elapsed.count() * 1e3, index->trigrams(),
+                index->memoryUsage() >> 10);
+    for (const char* query : {"timeout", "id=99999", "ERROR retry", "id=424242"})
+    {
+        std::size_t rows{0};
+        double seconds = secondsPerRun([&] {
+            search.reset(spans, index.get());
+            rows = search.search(query)->rows.size();
+        });
+        std::string label = std::string{"\""} + query + '"';
+        report(label.c_str(), seconds, rows);
+    }
+
+    std::printf("regex\n");
+    const char* patterns[]{"ERROR.*timeout", "id=4242\\d+$", "(miss|retry) user", "^\\S+ WARN"};
+    {
+        // a single run, it's that slow
+        std::regex regex{patterns[0]};
+        start = std::chrono::steady_clock::now();
+        std::size_t rows{0};
+        for (std::size_t i{0}; i < lines.size(); ++i)
+        {
+            std::string_view line = lines.line(data, i);
+            rows += std::regex_search(line.begin(), line.end(), regex);
+        }
+        elapsed = std::chrono::steady_clock::now() - start;
+        std::string label = std::string{"std::regex \""} + patterns[0] + '"';
+        report(label.c_str(), elapsed.count(), rows);
+    }
+    for (const char* pattern : patterns)
+    {
+        std::string error;
+        std::shared_ptr<const Regex> regex = Regex::compile(pattern, error);
+        for (unsigned threads : threadCounts)
+        {
+            std::size_t rows{0};
+            double seconds = secondsPerRun([&] {
+                search.reset(spans);
+                rows = search.searchRegex(regex, threads)->rows.size();
+            });
+            std::string label = std::string{"\""} + pattern + (threads == 1 ? "\", 1 thread" : "\", all cores");
+            report(label.c_str(), seconds, rows);
+        }
+    }
+
+    std::printf("replace \"timeout\" with \"TO\"\n");
+    {
+        std::shared_ptr<const SearchResult> matches = search.search("timeout");
+        std::size_t rows{0};
+        double seconds = secondsPerRun([&] {
+            std::vector<std::string> replaced;
+            for (int row : matches->rows)
+            {
+                std::string& text = replaced.emplace_back(search.rowText(row));
+                for (std::size_t at = text.find("timeout"); at != std::string::npos; at = text.find("timeout", at + 2))
+                {
+                    text.replace(at, 7, "TO");
+                }
+            }
+            rows = replaced.size();
+        });
+        report("string::replace", seconds, rows);
+        for (unsigned threads : threadCounts)
+        {
+            seconds = secondsPerRun([&] { rows = search.replace(*matches, nullptr, "TO", threads).rows.size(); });
+            report(threads == 1 ? "1 thread" : "all cores", seconds, rows);
+        }
+    }
+
+    return 0;
+}
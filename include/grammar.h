@@ -0,0 +1,149 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include "keywords.h"
+
+// A stretch of text highlighted as a whole, from an opening to a closing
+// delimiter: comments and string literals.
+struct SyntaxRegion
+{
+    std::string_view open;
+    // empty: the region runs to the end of the line
+    std::string_view close;
+    std::uint8_t highlight;
+    // the character after it never closes the region, '\0' for none
+    char escape{'\0'};
+    // an unclosed region carries over into the next line
+    bool multiLine{false};
+};
+
+// Character classes and region openers of a language compiled at compile
+// time into lookup tables. The highlighter classifies each byte with one load
+// and only walks the opener DFA on bytes that can start a region; the longest
+// opener wins, so """ is a Python docstring rather than an empty string.
+class GrammarTables
+{
+  public:
+    static constexpr std::size_t MAX_REGIONS{16};
+    static constexpr std::size_t MAX_NODES{64};
+    static constexpr std::size_t MAX_SYMBOLS{16};
+
+    static constexpr std::uint8_t CLASS_SEPARATOR{1 << 0};
+    static constexpr std::uint8_t CLASS_IDENTIFIER_START{1 << 1};
+    static constexpr std::uint8_t CLASS_IDENTIFIER{1 << 2};
+    static constexpr std::uint8_t CLASS_DIGIT{1 << 3};
+    static constexpr std::uint8_t CLASS_OPENER{1 << 4};
+
+    consteval GrammarTables(std::span<const SyntaxRegion> regions, std::span<const std::string_view> keywords)
+        : m_keywords{keywords}
+    {
+        if (regions.size() > MAX_REGIONS)
+            throw "too many regions for GrammarTables";
+
+        // opener trie over the bytes that appear in openers; symbol 0 and
+        // node 0 as a target both mean no transition
+        std::size_t symbols{1};
+        std::size_t nodes{1};
+        for (std::size_t r{0}; r < regions.size(); ++r)
+        {
+            m_regions[r] = regions[r];
+            if (regions[r].open.empty())
+                throw "region without an opening delimiter";
+
+            std::size_t node{0};
+            for (char ch : regions[r].open)
+            {
+                std::uint8_t& symbol = m_symbol[static_cast<unsigned char>(ch)];
+                if (!symbol)
+                {
+                    if (symbols == MAX_SYMBOLS)
+                        throw "too many distinct opener characters";
+                    symbol = symbols++;
+                }
+
+                std::uint8_t& next = m_next[node][symbol];
+                if (!next)
+                {
+                    if (nodes == MAX_NODES)
+                        throw "region openers too long";
+                    next = nodes++;
+                }
+                node = next;
+            }
+            if (m_accept[node] >= 0)
+                throw "two regions with the same opener";
+            m_accept[node] = r;
+        }
+
+        for (int c{0}; c < 256; ++c)
+        {
+            bool alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+            bool digit = c >= '0' && c <= '9';
+            std::uint8_t cls{0};
+            if (separator(c))
+                cls |= CLASS_SEPARATOR;
+            if (alpha)
+                cls |= CLASS_IDENTIFIER_START | CLASS_IDENTIFIER;
+            if (digit)
+                cls |= CLASS_DIGIT | CLASS_IDENTIFIER;
+            if (m_next[0][m_symbol[c]])
+                cls |= CLASS_OPENER;
+            m_class[c] = cls;
+        }
+    }
+
+    static constexpr bool separator(int c)
+    {
+        return c == ' ' || (c >= '\t' && c <= '\r') || c == '\0' ||
+               std::string_view{",.()+-/*=~%<>[];"}.find(static_cast<char>(c)) != std::string_view::npos;
+    }
+
+    constexpr std::uint8_t byteClass(char c) const
+    {
+        return m_class[static_cast<unsigned char>(c)];
+    }
+
+    // index of the region whose opener is the longest prefix of text, -1 if
+    // none is
+    constexpr int matchOpener(std::string_view text) const
+    {
+        int best{-1};
+        std::size_t node{0};
+        for (char ch : text)
+        {
+            node = m_next[node][m_symbol[static_cast<unsigned char>(ch)]];
+            if (!node)
+                break;
+            if (m_accept[node] >= 0)
+                best = m_accept[node];
+        }
+        return best;
+    }
+
+    constexpr const SyntaxRegion& region(int index) const
+    {
+        return m_regions[index];
+    }
+
+    constexpr const KeywordTable& keywords() const
+    {
+        return m_keywords;
+    }
+
+  private:
+    std::array<std::uint8_t, 256> m_class{};
+    std::array<std::uint8_t, 256> m_symbol{};
+    std::array<std::array<std::uint8_t, MAX_SYMBOLS>, MAX_NODES> m_next{};
+    std::array<std::int8_t, MAX_NODES> m_accept = [] {
+        std::array<std::int8_t, MAX_NODES> accept{};
+        accept.fill(-1);
+        return accept;
+    }();
+    std::array<SyntaxRegion, MAX_REGIONS> m_regions{};
+    KeywordTable m_keywords;
+};
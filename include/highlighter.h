@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "syntax.h"
+
+// A run of consecutive rows to highlight, in buffer order. Everything the
+// worker reads is owned by (or, for text in the mapped file, outlives) the
+// batch, so the editor can keep editing rows while it runs.
+struct HighlightBatch
+{
+    struct Item
+    {
+        std::string_view text;
+        // only loaded rows get a highlight back, the others just carry state
+        bool wantHighlight;
+        // state the row was last highlighted from, -1 if unknown
+        int previousStartState;
+    };
+
+    const EditorSyntax* syntax{nullptr};
+    std::uint64_t generation{0};
+    std::size_t firstRow{0};
+    int startState{HL_STATE_NORMAL};
+    bool urgent{false};
+    // stop once a row's computed start state matches previousStartState, as
+    // everything after it is then already up to date
+    bool stopWhenConverged{false};
+
+    std::vector<Item> items;
+    std::deque<std::string> copies;
+
+    // results, valid once the batch has been handed back
+    std::size_t processed{0};
+    bool converged{false};
+    std::vector<std::uint8_t> startStates;
+    std::vector<std::uint8_t> endStates;
+    std::vector<HighlightRuns> highlights;
+
+    // keeps a copy of text alive for the lifetime of the batch
+    void add(std::string text, int previousStartState)
+    {
+        items.push_back({copies.emplace_back(std::move(text)), true, previousStartState});
+    }
+    void addView(std::string_view text, int previousStartState)
+    {
+        items.push_back({text, false, previousStartState});
+    }
+};
+
+// Background thread that runs syntaxHighlightLine over submitted batches.
+// Urgent batches (the visible rows) pre-empt a running background batch,
+// which resumes where it stopped afterwards.
+class HighlightWorker
+{
+  public:
+    // notify is called from the worker thread whenever a batch finishes
+    explicit HighlightWorker(std::function<void()> notify);
+    HighlightWorker(const HighlightWorker&) = delete;
+    HighlightWorker& operator=(const HighlightWorker&) = delete;
+    ~HighlightWorker();
+
+    void submit(std::shared_ptr<HighlightBatch> batch);
+
+    // drops every queued batch; one that is running is still handed back
+    void cancelAll();
+
+    std::vector<std::shared_ptr<HighlightBatch>> takeFinished();
+
+  private:
+    void run();
+
+    std::function<void()> m_notify;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<std::shared_ptr<HighlightBatch>> m_urgent;
+    std::deque<std::shared_ptr<HighlightBatch>> m_background;
+    std::vector<std::shared_ptr<HighlightBatch>> m_finished;
+    std::atomic<bool> m_urgentPending{false};
+    bool m_stop{false};
+    std::thread m_thread;
+};
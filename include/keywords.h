@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// Perfect hash of a language's keywords, built at compile time.
+//
+// Keywords follow the HLDB convention: a trailing '|' marks a secondary
+// keyword (usually a type). A lookup hashes the identifier once and compares it
+// against the single keyword that can live in that slot.
+class KeywordTable
+{
+  public:
+    static constexpr std::size_t MAX_KEYWORDS{128};
+
+    consteval KeywordTable(std::span<const std::string_view> keywords)
+    {
+        if (keywords.size() > MAX_KEYWORDS)
+            throw "too many keywords for KeywordTable";
+
+        // try multipliers until every keyword lands in its own slot
+        for (std::uint32_t seed{0x9e3779b1u};; seed += 2)
+        {
+            if (seed < 0x9e3779b1u)
+                throw "no perfect hash found for keywords";
+
+            m_seed = seed;
+            m_slots = {};
+            bool collision = false;
+            for (std::string_view keyword : keywords)
+            {
+                int kind = KEYWORD_PRIMARY;
+                if (keyword.ends_with('|'))
+                {
+                    keyword.remove_suffix(1);
+                    kind = KEYWORD_SECONDARY;
+                }
+
+                Slot& slot = m_slots[hash(keyword)];
+                if (slot.kind)
+                {
+                    collision = true;
+                    break;
+                }
+                slot = {keyword, kind};
+            }
+
+            if (!collision)
+                return;
+        }
+    }
+
+    static constexpr int KEYWORD_NONE{0};
+    static constexpr int KEYWORD_PRIMARY{1};
+    static constexpr int KEYWORD_SECONDARY{2};
+
+    // KEYWORD_NONE, KEYWORD_PRIMARY or KEYWORD_SECONDARY
+    constexpr int lookup(std::string_view word) const
+    {
+        if (word.empty())
+            return KEYWORD_NONE;
+
+        const Slot& slot = m_slots[hash(word)];
+        return slot.word == word ? slot.kind : KEYWORD_NONE;
+    }
+
+  private:
+    static constexpr int BITS{9};
+
+    struct Slot
+    {
+        std::string_view word;
+        int kind{KEYWORD_NONE};
+    };
+
+    // mixes the length and the characters at both ends and in the middle,
+    // which is enough to tell keywords apart once a suitable multiplier is found
+    constexpr std::size_t hash(std::string_view word) const
+    {
+        std::size_t n = word.size();
+        std::uint32_t key = static_cast<std::uint8_t>(word[0]) | static_cast<std::uint8_t>(word[n > 1]) << 8 |
+                            static_cast<std::uint8_t>(word[n - 1]) << 16 |
+                            static_cast<std::uint8_t>(word[n - 1 - (n > 1)]) << 24;
+        key ^= static_cast<std::uint8_t>(word[n / 2]) * 0x27d4eb2du ^ static_cast<std::uint32_t>(n) * 0x85ebca6bu;
+        return (key * m_seed) >> (32 - BITS);
+    }
+
+    std::uint32_t m_seed{0};
+    std::array<Slot, 1 << BITS> m_slots{};
+};
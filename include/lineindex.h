@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Newline scanning implementation used to build the index. Auto picks the
+// widest one the CPU supports.
+enum class ScanKernel
+{
+    Auto,
+    Scalar,
+    Sse2,
+    Avx2,
+};
+
+// Byte offsets of every line in a buffer. Only the offsets are stored, line
+// text is sliced out of the original buffer on demand.
+class LineIndex
+{
+  public:
+    // threads == 0 uses every hardware thread
+    static LineIndex build(std::string_view data, unsigned threads = 0, ScanKernel kernel = ScanKernel::Auto);
+    static bool kernelSupported(ScanKernel kernel);
+
+    std::size_t size() const
+    {
+        return m_starts.empty() ? 0 : m_starts.size() - 1;
+    }
+
+    // text of line i without its trailing newline / carriage return
+    std::string_view line(std::string_view data, std::size_t i) const
+    {
+        std::uint64_t start = m_starts[i] & OFFSET_MASK;
+        std::uint64_t end = m_starts[i + 1] & OFFSET_MASK;
+
+        if (end > start && data[end - 1] == '\n')
+            --end;
+        if (m_starts[i + 1] & CRLF_FLAG)
+            --end;
+
+        return data.substr(start, end - start);
+    }
+
+    // offset line i starts at, size() giving the end of the last line
+    std::size_t start(std::size_t i) const
+    {
+        return m_starts[i] & OFFSET_MASK;
+    }
+
+    // line the byte at offset is in, offset < start(size())
+    std::size_t lineAt(std::size_t offset) const;
+    // the same, for offset in line from or after it; gallops forward from
+    // there, so looking up offsets in order stays close to the last one
+    std::size_t lineAt(std::size_t offset, std::size_t from) const;
+
+  private:
+    // set on the entry following a line that ended in "\r\n", the scanner
+    // finds CRs in the same pass as the newlines
+    static constexpr std::uint64_t CRLF_FLAG{1ull << 63};
+    static constexpr std::uint64_t OFFSET_MASK{CRLF_FLAG - 1};
+
+    // start offset of every line followed by a sentinel at data.size()
+    std::vector<std::uint64_t> m_starts;
+};
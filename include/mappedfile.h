@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a whole file. Pages are faulted in by the kernel
+// on first access, so opening is O(1) regardless of file size.
+class MappedFile
+{
+  public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    // returns false and leaves errno set on failure
+    bool open(const std::string& path);
+    void close();
+
+    std::string_view view() const
+    {
+        return {m_data, m_size};
+    }
+
+  private:
+    const char* m_data{nullptr};
+    std::size_t m_size{0};
+};
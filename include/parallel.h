@@ -0,0 +1,20 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+
+// runs f(0) .. f(n - 1) on n threads, f(0) on the calling thread
+template <typename F> void parallelFor(unsigned n, F&& f)
+{
+    std::vector<std::thread> workers;
+    workers.reserve(n - 1);
+    for (unsigned i{1}; i < n; ++i)
+    {
+        workers.emplace_back([&f, i] { f(i); });
+    }
+    f(0);
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
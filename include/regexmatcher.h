@@ -0,0 +1,304 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A regular expression compiled to a byte level NFA, which RegexMatcher runs
+// as DFAs built state by state as text needs them. Supports literals, ., [classes], \d \w \s and their
+// negations, groups, |, * + ? {n,m} and the ^ $ anchors. . and classes match
+// whole UTF-8 characters; classes can only hold non-ASCII characters singly and
+// not negated.
+//
+// A match is a non-empty stretch of a single line. Matches are leftmost-longest
+// and don't overlap, each found after the end of the one before.
+class Regex
+{
+  public:
+    // null when pattern is invalid, with why in error
+    static std::shared_ptr<const Regex> compile(std::string_view pattern, std::string& error);
+
+    const std::string& pattern() const
+    {
+        return m_pattern;
+    }
+
+    // a string every match contains, empty when there isn't one; rows without
+    // it can be ruled out by a substring search
+    const std::string& literal() const
+    {
+        return m_literal;
+    }
+
+    // the compiled form, as RegexMatcher runs it
+
+    enum class Op : std::uint8_t
+    {
+        // consumes a byte in set and goes on to out
+        Byte,
+        // goes on to both out and alt
+        Split,
+        // goes on to out at the start of the line
+        AssertStart,
+        // goes on to out at the end of the line
+        AssertEnd,
+        Match,
+    };
+
+    struct Inst
+    {
+        Op op;
+        int out{-1};
+        int alt{-1};
+        // index into sets
+        int set{-1};
+    };
+
+    struct Program
+    {
+        std::vector<Inst> insts;
+        int start{0};
+    };
+
+    const Program& program() const
+    {
+        return m_program;
+    }
+
+    const std::vector<std::bitset<256>>& sets() const
+    {
+        return m_sets;
+    }
+
+    // bytes that no set tells apart share a class, so DFA states need one
+    // transition per class rather than per byte
+    const std::array<std::uint8_t, 256>& byteClass() const
+    {
+        return m_byteClass;
+    }
+
+    int classes() const
+    {
+        return m_classes;
+    }
+
+  private:
+    std::string m_pattern;
+    std::string m_literal;
+    Program m_program;
+    std::vector<std::bitset<256>> m_sets;
+    std::array<std::uint8_t, 256> m_byteClass{};
+    int m_classes{0};
+};
+
+// A match of a Regex, as byte offsets into the line.
+struct RegexMatch
+{
+    std::size_t start;
+    std::size_t end;
+};
+
+// Runs a Regex over lines. Holds the DFA states built so far, so it should
+// live across lines, but it can only be used by one thread at a time. Every
+// line takes one pass over it to test for a match. Finding where the matches
+// are takes a pass backwards for what can still go on to a match at each byte,
+// then one forwards that only goes over the matches, each taken as far as it
+// can reach: both are linear in the length of the line.
+class RegexMatcher
+{
+  public:
+    explicit RegexMatcher(std::shared_ptr<const Regex> regex);
+
+    const std::shared_ptr<const Regex>& regex() const
+    {
+        return m_regex;
+    }
+
+    bool contains(std::string_view line);
+    // matches(line).size(), lines without one only run through contains()
+    std::size_t count(std::string_view line);
+    std::vector<RegexMatch> matches(std::string_view line);
+
+  private:
+    // A program run as a DFA, a state per set of instructions the NFA can be
+    // in, its transitions filled in when first taken. Unanchored it can start
+    // a match at any byte, and states only hold matches at least a byte long.
+    //
+    // A state is named by where its transitions start, with MATCHING set when
+    // a match ends in it, so taking a transition and testing for a match take
+    // one load between them.
+    class Dfa
+    {
+      public:
+        static constexpr int DEAD{0};
+        static constexpr int MATCHING{1 << 30};
+
+        Dfa(const Regex& regex, const Regex::Program& program, bool unanchored);
+
+        // the state before the line's first byte, or before a later byte
+        int start(bool atLineStart);
+
+        int next(int state, unsigned char byte)
+        {
+            int to = m_transitions[(state & ~MATCHING) + m_byteClass[byte]];
+            return to >= 0 ? to : step(state, byte);
+        }
+
+        // a match ends at the last byte consumed
+        static bool matching(int state)
+        {
+            return state & MATCHING;
+        }
+
+        // a match ends at the last byte consumed when the line ends there
+        bool matchingAtEnd(int state) const
+        {
+            return m_states[(state & ~MATCHING) / m_classes].matchAtEnd;
+        }
+
+        // the instructions of state, sorted
+        const std::vector<int>& insts(int state) const
+        {
+            return m_states[(state & ~MATCHING) / m_classes].insts;
+        }
+
+        // the instructions reached from pc without consuming a byte, sorted
+        std::vector<int> closure(int pc, bool atLineStart, bool atLineEnd);
+
+        // bumped whenever the states are dropped and their names reused
+        std::uint32_t flushes() const
+        {
+            return m_flushes;
+        }
+
+      private:
+        struct State
+        {
+            std::vector<int> insts;
+            bool match;
+            bool matchAtEnd;
+        };
+
+        // the instructions reached from pc without consuming a byte; ^ is only
+        // passed at the start, $ only once the line has ended
+        void close(int pc, bool atLineStart, bool atLineEnd, std::vector<int>& out);
+        int intern(std::vector<int> insts);
+        // fills in the transition, unless the states are dropped to make room
+        int step(int state, unsigned char byte);
+
+        const Regex& m_regex;
+        const Regex::Program& m_program;
+        bool m_unanchored;
+        std::array<std::uint8_t, 256> m_byteClass;
+        int m_classes;
+        // instructions close() has added since m_visit was last bumped
+        std::vector<std::uint32_t> m_visited;
+        std::uint32_t m_visit{0};
+        std::vector<int> m_stack;
+        std::vector<State> m_states;
+        std::map<std::vector<int>, int> m_ids;
+        // m_classes per state, -1 until taken
+        std::vector<int> m_transitions;
+        // instructions an unanchored match can start at, past the start of a
+        // line and at it
+        std::vector<int> m_startInsts[2];
+        int m_start[2]{-1, -1};
+        std::uint32_t m_flushes{0};
+    };
+
+    // Which of the program's byte instructions can still go on to a match at a
+    // byte of a line: those taking the byte that a match ends right after, or
+    // that go on to one that can at the next byte. Run backwards from the end
+    // of the line, a state per set of them, built as the line needs them.
+    //
+    // A pass holds on to a state for every byte, so states are only dropped
+    // between lines.
+    class Reach
+    {
+      public:
+        // dfa runs the same program anchored, its states are the ones
+        // reaches() is asked about
+        Reach(const Regex& regex, Dfa& dfa);
+
+        // the state past the last byte of a line
+        int end() const
+        {
+            return m_end;
+        }
+
+        // the state at byte, the one before state's
+        int next(int state, unsigned char byte)
+        {
+            int to = m_transitions[state * m_classes + m_byteClass[byte]];
+            return to >= 0 ? to : step(state, byte);
+        }
+
+        // some instruction of anchored, a state of the DFA, goes on to a match
+        // from the byte at state
+        bool reaches(int state, int anchored);
+        // a match starts at the byte at state
+        bool startsMatch(int state, bool atLineStart);
+
+        // drops the states if there are too many, before a pass
+        void trim();
+
+      private:
+        // what a byte instruction goes on to once it takes its byte
+        struct Successors
+        {
+            bool known{false};
+            std::vector<int> bytes;
+            bool match{false};
+            bool matchAtEnd{false};
+        };
+
+        struct State
+        {
+            std::vector<int> insts;
+            // startsMatch() past the start of a line and at it, -1 until asked
+            std::int8_t starts[2]{-1, -1};
+            // the last reaches() asked, as a match is taken through the same
+            // pair of states over and over
+            int anchored{-1};
+            std::uint32_t flushes{0};
+            bool reaches{false};
+        };
+
+        bool overlaps(const std::vector<int>& live, const std::vector<int>& insts) const;
+
+        const Successors& successors(int pc);
+        int intern(std::vector<int> insts);
+        int step(int state, unsigned char byte);
+
+        const Regex& m_regex;
+        Dfa& m_dfa;
+        std::array<std::uint8_t, 256> m_byteClass;
+        int m_classes;
+        std::vector<Successors> m_successors;
+        // the program's byte instructions, ascending
+        std::vector<int> m_bytes;
+        // instructions a match can start at, past the start of a line and at it
+        std::vector<int> m_startInsts[2];
+        // instructions of the state being stepped from, those equal to m_mark
+        std::vector<std::uint32_t> m_marked;
+        std::uint32_t m_mark{0};
+        std::vector<State> m_states;
+        std::map<std::vector<int>, int> m_ids;
+        // m_classes per state, -1 until taken
+        std::vector<int> m_transitions;
+        int m_end{0};
+    };
+
+    std::shared_ptr<const Regex> m_regex;
+    Dfa m_search;
+    Dfa m_extend;
+    Reach m_reach;
+    // the state of m_reach at every byte of the line
+    std::vector<int> m_reachAt;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+// Memory resource for row text. Small allocations are served from size
+// classes 16 bytes apart, carved in order out of large chunks and recycled
+// through a free list per class, so loading rows doesn't call malloc once per
+// string and rows loaded together sit together. It keeps count of what is
+// live against what it holds from the system, which tells the editor when
+// enough has been freed that moving the rows into a fresh arena is worth it.
+class RowArena : public std::pmr::memory_resource
+{
+  public:
+    RowArena() = default;
+    RowArena(const RowArena&) = delete;
+    RowArena& operator=(const RowArena&) = delete;
+    ~RowArena();
+
+    // bytes handed out and not yet returned
+    std::size_t liveBytes() const
+    {
+        return m_live;
+    }
+    // bytes taken from the system
+    std::size_t reservedBytes() const
+    {
+        return m_reserved;
+    }
+    std::size_t allocations() const
+    {
+        return m_allocations;
+    }
+    // allocations that had to go to the system
+    std::size_t systemAllocations() const
+    {
+        return m_systemAllocations;
+    }
+
+    // true once most of what the arena holds is no longer in use
+    bool fragmented() const;
+
+  private:
+    static constexpr std::size_t GRANULARITY{16};
+    static constexpr std::size_t LARGEST_POOLED{4096};
+    static constexpr std::size_t CHUNK_SIZE{1u << 20};
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+    std::array<FreeBlock*, LARGEST_POOLED / GRANULARITY + 1> m_free{};
+    std::vector<void*> m_chunks;
+    char* m_next{nullptr};
+    char* m_end{nullptr};
+
+    std::size_t m_live{0};
+    std::size_t m_reserved{0};
+    std::size_t m_allocations{0};
+    std::size_t m_systemAllocations{0};
+};
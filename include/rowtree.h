@@ -0,0 +1,478 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Sequence container for editor rows backed by an implicit treap.
+// Nodes are ordered by position only (no keys); every node caches the number
+// of lines in its subtree so insert, erase and access by line number are all
+// O(log n).
+//
+// A node is either a materialised row or a run of rows that have not been
+// loaded yet, identified by their line number in a backing source. Runs are
+// split and loaded on first access, so a buffer built from assignSource() only
+// pays for the rows that are actually looked at.
+//
+// Rows can also be given weights, and every node then caches the total weight
+// of its subtree too, so the rows' weights can be summed and searched like a
+// prefix sum in O(log n). Unloaded rows are weighed through their source
+// lines, so weighing a run of them doesn't load it. Without weights every
+// row weighs 1.
+//
+// Nodes are carved in order out of blocks and recycled through a free list,
+// so loading rows doesn't allocate once per row and rows loaded together sit
+// together.
+template <typename T> class RowTree
+{
+    struct Node
+    {
+        std::optional<T> value;
+        std::size_t first{0};
+        std::size_t count{1};
+        std::uint32_t priority;
+        // weight of the row, or of the whole run
+        std::uint32_t weight{1};
+        Node* left{nullptr};
+        Node* right{nullptr};
+        std::size_t size{1};
+        std::size_t totalWeight{1};
+    };
+
+    // a node's storage, or the next free one while it's unused
+    union Slot
+    {
+        Slot* next;
+        alignas(Node) std::byte node[sizeof(Node)];
+    };
+    static constexpr std::size_t BLOCK_NODES{1024};
+
+  public:
+    using Loader = std::function<T(std::size_t)>;
+    using Weigher = std::function<std::size_t(const T&)>;
+    // total weight of the source lines before line
+    using SourceWeigher = std::function<std::size_t(std::size_t line)>;
+
+    RowTree() = default;
+    RowTree(const RowTree&) = delete;
+    RowTree& operator=(const RowTree&) = delete;
+    ~RowTree()
+    {
+        clear();
+    }
+
+    std::size_t size() const
+    {
+        return sizeOf(m_root);
+    }
+    bool empty() const
+    {
+        return !m_root;
+    }
+
+    // returns the row at position at, loading it from the source if needed
+    T& operator[](std::size_t at)
+    {
+        std::size_t position = at;
+        Node* node = m_root;
+        while (true)
+        {
+            std::size_t leftSize = sizeOf(node->left);
+            if (at < leftSize)
+            {
+                node = node->left;
+            }
+            else if (at >= leftSize + node->count)
+            {
+                at -= leftSize + node->count;
+                node = node->right;
+            }
+            else if (node->value)
+            {
+                return *node->value;
+            }
+            else
+            {
+                return load(position);
+            }
+        }
+    }
+
+    // returns the row at position at if it is loaded; otherwise returns nullptr
+    // and stores its line number in the backing source
+    T* peek(std::size_t at, std::size_t& sourceLine)
+    {
+        Node* node = m_root;
+        while (true)
+        {
+            std::size_t leftSize = sizeOf(node->left);
+            if (at < leftSize)
+            {
+                node = node->left;
+            }
+            else if (at >= leftSize + node->count)
+            {
+                at -= leftSize + node->count;
+                node = node->right;
+            }
+            else
+            {
+                if (node->value)
+                    return &*node->value;
+                sourceLine = node->first + (at - leftSize);
+                return nullptr;
+            }
+        }
+    }
+
+    // inserts value so that it ends up at position at (0 <= at <= size())
+    T& insert(std::size_t at, T value)
+    {
+        Node* node = newNode(std::move(value), 0, 1);
+        weigh(node);
+        auto [left, right] = split(m_root, at);
+        m_root = merge(merge(left, node), right);
+        return *node->value;
+    }
+
+    void erase(std::size_t at)
+    {
+        auto [left, rest] = split(m_root, at);
+        auto [middle, right] = split(rest, 1);
+        destroy(middle);
+        m_root = merge(left, right);
+    }
+
+    // replaces the contents with count unloaded rows, row i being produced by
+    // loader(i) when it is first accessed
+    void assignSource(std::size_t count, Loader loader)
+    {
+        clear();
+        m_loader = std::move(loader);
+        if (count)
+        {
+            m_root = newNode(std::nullopt, 0, count);
+            m_root->size = count;
+            weigh(m_root);
+        }
+    }
+
+    // weighs rows with weigher and runs of unloaded rows with sourceWeigher
+    // from now on, or every row as 1 when they are empty; O(nodes)
+    void setWeights(Weigher weigher, SourceWeigher sourceWeigher)
+    {
+        m_weigher = std::move(weigher);
+        m_sourceWeigher = std::move(sourceWeigher);
+        reweighAll(m_root);
+    }
+
+    // weighs row at again after it changed
+    void reweigh(std::size_t at)
+    {
+        if (m_weigher)
+            reweigh(m_root, at);
+    }
+
+    // total weight of all rows
+    std::size_t weight() const
+    {
+        return weightOf(m_root);
+    }
+
+    // total weight of the rows before position at
+    std::size_t weightBefore(std::size_t at) const
+    {
+        std::size_t total{0};
+        const Node* node = m_root;
+        while (node)
+        {
+            std::size_t leftSize = sizeOf(node->left);
+            if (at < leftSize)
+            {
+                node = node->left;
+            }
+            else if (at >= leftSize + node->count)
+            {
+                at -= leftSize + node->count;
+                total += weightOf(node->left) + node->weight;
+                node = node->right;
+            }
+            else
+            {
+                return total + weightOf(node->left) + runWeight(node, at - leftSize);
+            }
+        }
+        return total;
+    }
+
+    // position of the row that the weight w falls into, counting from the
+    // first row, with how far into that row's weight w is; size() when w is
+    // past the total
+    std::size_t findWeight(std::size_t w, std::size_t& offset) const
+    {
+        std::size_t position{0};
+        const Node* node = m_root;
+        while (node)
+        {
+            std::size_t leftWeight = weightOf(node->left);
+            if (w < leftWeight)
+            {
+                node = node->left;
+                continue;
+            }
+            w -= leftWeight;
+            position += sizeOf(node->left);
+            if (w >= node->weight)
+            {
+                w -= node->weight;
+                position += node->count;
+                node = node->right;
+                continue;
+            }
+
+            // the last row of the run starting at or before w
+            std::size_t low{0};
+            std::size_t high{node->count - 1};
+            while (low < high)
+            {
+                std::size_t middle = (low + high + 1) / 2;
+                if (runWeight(node, middle) <= w)
+                    low = middle;
+                else
+                    high = middle - 1;
+            }
+            offset = w - runWeight(node, low);
+            return position + low;
+        }
+        offset = w;
+        return position;
+    }
+
+    void clear()
+    {
+        destroy(m_root);
+        m_root = nullptr;
+        m_blocks.clear();
+        m_free = nullptr;
+        m_used = BLOCK_NODES;
+    }
+
+    // calls f(row) for every loaded row, in order
+    template <typename F> void forEachLoaded(F&& f)
+    {
+        visit(m_root, [&](Node* node) {
+            if (node->value)
+                f(*node->value);
+        });
+    }
+
+    // calls f(row, first, count) for every node in order; row is nullptr for a
+    // run of count unloaded rows starting at source line first
+    template <typename F> void forEachSpan(F&& f)
+    {
+        visit(m_root, [&](Node* node) { f(node->value ? &*node->value : nullptr, node->first, node->count); });
+    }
+
+  private:
+    static std::size_t sizeOf(const Node* node)
+    {
+        return node ? node->size : 0;
+    }
+
+    static std::size_t weightOf(const Node* node)
+    {
+        return node ? node->totalWeight : 0;
+    }
+
+    static void update(Node* node)
+    {
+        node->size = node->count + sizeOf(node->left) + sizeOf(node->right);
+        node->totalWeight = node->weight + weightOf(node->left) + weightOf(node->right);
+    }
+
+    // weight of the first rows of node, which all of them weigh for a row
+    std::size_t runWeight(const Node* node, std::size_t rows) const
+    {
+        if (rows == node->count)
+            return node->weight;
+        if (!m_sourceWeigher || node->value)
+            return rows;
+        return m_sourceWeigher(node->first + rows) - m_sourceWeigher(node->first);
+    }
+
+    // sets node's own weight; its subtree's is left to update()
+    void weigh(Node* node)
+    {
+        if (node->value && m_weigher)
+            node->weight = m_weigher(*node->value);
+        else if (!node->value && m_sourceWeigher)
+            node->weight = m_sourceWeigher(node->first + node->count) - m_sourceWeigher(node->first);
+        else
+            node->weight = node->count;
+        node->totalWeight = node->weight + weightOf(node->left) + weightOf(node->right);
+    }
+
+    void reweighAll(Node* node)
+    {
+        if (!node)
+            return;
+        reweighAll(node->left);
+        reweighAll(node->right);
+        weigh(node);
+    }
+
+    // returns how much the weight of the subtree changed
+    std::size_t reweigh(Node* node, std::size_t at)
+    {
+        std::size_t leftSize = sizeOf(node->left);
+        std::size_t change;
+        if (at < leftSize)
+        {
+            change = reweigh(node->left, at);
+        }
+        else if (at >= leftSize + node->count)
+        {
+            change = reweigh(node->right, at - leftSize - node->count);
+        }
+        else
+        {
+            std::size_t before = node->weight;
+            weigh(node);
+            return node->weight - before;
+        }
+        // unsigned wrap-around makes a decrease come out right too
+        node->totalWeight += change;
+        return change;
+    }
+
+    // splits into [0, at) and [at, size), cutting an unloaded run in two when
+    // the split point falls inside it
+    std::pair<Node*, Node*> split(Node* node, std::size_t at)
+    {
+        if (!node)
+            return {nullptr, nullptr};
+
+        std::size_t leftSize = sizeOf(node->left);
+        if (at <= leftSize)
+        {
+            auto [left, right] = split(node->left, at);
+            node->left = right;
+            update(node);
+            return {left, node};
+        }
+
+        if (at < leftSize + node->count)
+        {
+            std::size_t keep = at - leftSize;
+            Node* tail = newNode(std::nullopt, node->first + keep, node->count - keep);
+            tail->size = tail->count;
+            weigh(tail);
+            node->count = keep;
+            weigh(node);
+
+            Node* right = merge(tail, node->right);
+            node->right = nullptr;
+            update(node);
+            return {node, right};
+        }
+
+        auto [left, right] = split(node->right, at - leftSize - node->count);
+        node->right = left;
+        update(node);
+        return {node, right};
+    }
+
+    static Node* merge(Node* left, Node* right)
+    {
+        if (!left)
+            return right;
+        if (!right)
+            return left;
+
+        if (left->priority > right->priority)
+        {
+            left->right = merge(left->right, right);
+            update(left);
+            return left;
+        }
+
+        right->left = merge(left, right->left);
+        update(right);
+        return right;
+    }
+
+    // isolates the unloaded row at position at into its own node and loads it
+    T& load(std::size_t at)
+    {
+        auto [left, rest] = split(m_root, at);
+        auto [middle, right] = split(rest, 1);
+        middle->value.emplace(m_loader(middle->first));
+        weigh(middle);
+        m_root = merge(merge(left, middle), right);
+        return *middle->value;
+    }
+
+    template <typename F> static void visit(Node* node, F&& f)
+    {
+        if (!node)
+            return;
+        visit(node->left, f);
+        f(node);
+        visit(node->right, f);
+    }
+
+    Node* newNode(std::optional<T> value, std::size_t first, std::size_t count)
+    {
+        Slot* slot = m_free;
+        if (slot)
+        {
+            m_free = slot->next;
+        }
+        else
+        {
+            if (m_used == BLOCK_NODES)
+            {
+                m_blocks.push_back(std::make_unique_for_overwrite<Slot[]>(BLOCK_NODES));
+                m_used = 0;
+            }
+            slot = &m_blocks.back()[m_used++];
+        }
+        return ::new (slot->node) Node{std::move(value), first, count, nextPriority()};
+    }
+
+    void destroy(Node* node)
+    {
+        if (!node)
+            return;
+        destroy(node->left);
+        destroy(node->right);
+        std::destroy_at(node);
+        Slot* slot = reinterpret_cast<Slot*>(node);
+        slot->next = m_free;
+        m_free = slot;
+    }
+
+    // xorshift32, good enough to keep the treap balanced
+    std::uint32_t nextPriority()
+    {
+        m_seed ^= m_seed << 13;
+        m_seed ^= m_seed >> 17;
+        m_seed ^= m_seed << 5;
+        return m_seed;
+    }
+
+    Node* m_root{nullptr};
+    std::vector<std::unique_ptr<Slot[]>> m_blocks;
+    Slot* m_free{nullptr};
+    // nodes taken from the last block
+    std::size_t m_used{BLOCK_NODES};
+    Loader m_loader;
+    Weigher m_weigher;
+    SourceWeigher m_sourceWeigher;
+    std::uint32_t m_seed{2463534242u};
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Display attributes of a cell
+struct Attr
+{
+    std::uint8_t fg{0}; // SGR foreground code (30-37), 0 for the terminal default
+    std::uint8_t flags{0};
+
+    bool operator==(const Attr&) const = default;
+};
+
+#define ATTR_INVERSE (1 << 0)
+
+struct Cell
+{
+    // UTF-8 bytes of the glyph packed little-endian, 0 for the right half of a
+    // double width glyph
+    std::uint32_t glyph{' '};
+    Attr attr;
+
+    bool operator==(const Cell&) const = default;
+};
+
+// Double buffered character grid. The editor composes each frame into the back
+// grid, flush() diffs it against what the terminal is known to show and emits
+// only the escape sequences and text needed to turn one into the other.
+class Screen
+{
+  public:
+    void resize(int rows, int cols);
+
+    // forget what the terminal shows; the next flush clears and repaints
+    void invalidate();
+
+    int rows() const
+    {
+        return m_rows;
+    }
+    int cols() const
+    {
+        return m_cols;
+    }
+
+    // blanks row y of the frame being composed
+    void clearRow(int y);
+
+    // shifts rows top..bottom (inclusive) of what the terminal shows up by
+    // lines (down when negative); the next flush does it with a scroll region
+    // so the moved rows don't have to be redrawn
+    void scroll(int top, int bottom, int lines);
+
+    // writes UTF-8 text at (y, x) clipped to the row, returns the column
+    // after it; wide glyphs take two cells and combining marks none
+    int put(int y, int x, std::string_view text, Attr attr = {});
+
+    // row y of the frame as composed so far, for callers that cache it
+    std::span<const Cell> row(int y) const
+    {
+        return {m_back.data() + static_cast<std::size_t>(y) * m_cols, static_cast<std::size_t>(m_cols)};
+    }
+
+    // replaces row y of the frame with cells saved earlier through row()
+    void putRow(int y, std::span<const Cell> cells);
+
+    // appends to out the bytes that update the terminal to the composed frame
+    // and park the cursor at (cursorY, cursorX); only rows written since the
+    // last flush are compared
+    void flush(std::string& out, int cursorY, int cursorX);
+
+  private:
+    Cell* backRow(int y)
+    {
+        return m_back.data() + static_cast<std::size_t>(y) * m_cols;
+    }
+    Cell* frontRow(int y)
+    {
+        return m_front.data() + static_cast<std::size_t>(y) * m_cols;
+    }
+
+    struct ScrollOp
+    {
+        int top;
+        int bottom;
+        int lines;
+    };
+
+    void moveTo(std::string& out, int y, int x);
+    void setAttr(std::string& out, Attr attr);
+
+    int m_rows{0};
+    int m_cols{0};
+    std::vector<Cell> m_back;
+    std::vector<Cell> m_front;
+    // rows written since the last flush, the only ones that can differ
+    std::vector<char> m_touched;
+    bool m_fullRepaint{true};
+    std::vector<ScrollOp> m_scrolls;
+
+    // terminal state as of the end of the last flush, -1 when unknown
+    int m_cursorY{-1};
+    int m_cursorX{-1};
+    Attr m_attr;
+    bool m_attrKnown{false};
+};
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "lineindex.h"
+#include "regexmatcher.h"
+#include "trigramindex.h"
+
+// Substring matching implementation. Auto picks the widest one the CPU
+// supports.
+enum class SearchKernel
+{
+    Auto,
+    Scalar,
+    Sse2,
+    Avx2,
+};
+
+// A stretch of the buffer to search, the spans of a buffer covering its rows
+// in order: either a single row, or a run of consecutive lines of a file,
+// which is searched in one pass over the file's bytes.
+struct SearchSpan
+{
+    // first row of the span and how many it covers
+    int row;
+    int count;
+    // the row's text, or for a run the whole file that lines indexes, the run
+    // starting at its line firstLine
+    std::string_view text;
+    const LineIndex* lines;
+    std::size_t firstLine;
+};
+
+// The rows containing a query in ascending order, with how many times each
+// does. Matches are counted without overlapping, from the start of the row.
+struct SearchResult
+{
+    std::string query;
+    // query is a Regex pattern, its matches found as RegexMatcher does
+    bool regex{false};
+    std::vector<int> rows;
+    // matches in rows[0] .. rows[i]
+    std::vector<std::size_t> counts;
+
+    std::size_t total() const
+    {
+        return counts.empty() ? 0 : counts.back();
+    }
+};
+
+// The rows a replace all changes in ascending order, each with its new text,
+// and how many matches were replaced in them.
+struct Replacement
+{
+    std::vector<int> rows;
+    std::vector<std::string> texts;
+    std::size_t count{0};
+};
+
+// Finds and counts the matches of a query in a buffer. The first bytes of a query
+// are matched many positions at a time and only candidates are compared in
+// full, with the buffer split across threads. A query extending one searched
+// before only rechecks the rows that matched it, and results are kept for
+// every prefix so deleting characters from the end goes back to them.
+class TextSearch
+{
+  public:
+    // searches spans from now on, dropping earlier results; the text they
+    // point to must stay unchanged until the next reset. index, when given,
+    // covers the file every run of lines is in and picks which parts of the
+    // runs are scanned
+    void reset(std::vector<SearchSpan> spans, const TrigramIndex* index = nullptr);
+
+    // matches of query, none for an empty one; threads == 0 uses every
+    // hardware thread
+    std::shared_ptr<const SearchResult> search(std::string_view query, unsigned threads = 0,
+                                               SearchKernel kernel = SearchKernel::Auto);
+    // matches of regex; only the rows containing its literal are run through
+    // the DFA when it has one, the literal found like any other query
+    std::shared_ptr<const SearchResult> searchRegex(const std::shared_ptr<const Regex>& regex, unsigned threads = 0,
+                                                    SearchKernel kernel = SearchKernel::Auto);
+
+    // matches, found by this search since the last reset, each replaced by
+    // replacement; regex is the one they were found with, null for a query.
+    // The rows are built across threads, those left as they were dropped
+    Replacement replace(const SearchResult& matches, const std::shared_ptr<const Regex>& regex,
+                        std::string_view replacement, unsigned threads = 0) const;
+
+    std::string_view rowText(int row) const;
+
+    static bool kernelSupported(SearchKernel kernel);
+
+  private:
+    // a row in the spans, as the span and the row's place in it
+    struct Position
+    {
+        std::size_t span;
+        int row;
+    };
+
+    Position locate(std::size_t byte) const;
+
+    std::vector<SearchSpan> m_spans;
+    // offset of every span with the spans laid end to end, a row counted with
+    // the newline after it, followed by the total
+    std::vector<std::size_t> m_offsets;
+    int m_rows{0};
+    const TrigramIndex* m_index{nullptr};
+    // results for the last query and the prefixes of it searched before,
+    // shortest first
+    std::vector<std::shared_ptr<const SearchResult>> m_results;
+};
+
+// Background thread running TextSearch for the find prompt, so typing never
+// waits for a scan. Only the latest query submitted is searched, queries
+// replaced while one runs are never started.
+class SearchWorker
+{
+  public:
+    // notify is called from the worker thread whenever a search finishes
+    explicit SearchWorker(std::function<void()> notify);
+    SearchWorker(const SearchWorker&) = delete;
+    SearchWorker& operator=(const SearchWorker&) = delete;
+    ~SearchWorker();
+
+    // searches spans from now on, as TextSearch::reset; waits for a running
+    // search and drops a waiting one and any unclaimed result
+    void reset(std::vector<SearchSpan> spans, const TrigramIndex* index = nullptr);
+
+    void submit(std::string query);
+    void submit(std::shared_ptr<const Regex> regex);
+
+    // the result of the last search finished since the last call, if any
+    std::shared_ptr<const SearchResult> takeFinished();
+    // takeFinished() once the last query submitted has been searched
+    std::shared_ptr<const SearchResult> wait();
+
+  private:
+    // a query, or a regex when set
+    struct Query
+    {
+        std::string text;
+        std::shared_ptr<const Regex> regex;
+    };
+
+    void run();
+
+    std::function<void()> m_notify;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    // held while searching, so reset() can wait for the search to end
+    std::mutex m_searching;
+    TextSearch m_search;
+    std::optional<Query> m_pending;
+    bool m_busy{false};
+    // bumped by reset(), a search started before it keeps its result
+    std::uint64_t m_generation{0};
+    std::shared_ptr<const SearchResult> m_finished;
+    bool m_stop{false};
+    std::thread m_thread;
+};
+
+// Runs a replace all on a background thread, from the search to the rows it
+// changes, for the editor to swap in once it's done. The rows are gone
+// through a chunk at a time, and destroying the replacer stops it after the
+// chunk it's on.
+class Replacer
+{
+  public:
+    // searches spans and index as TextSearch::reset does, the text must stay
+    // unchanged until the replacer is destroyed; regex null searches for
+    // query. notify is called from the thread after each chunk and once the
+    // rows are built
+    Replacer(std::vector<SearchSpan> spans, const TrigramIndex* index, std::string query,
+             std::shared_ptr<const Regex> regex, std::string replacement, std::function<void()> notify);
+    Replacer(const Replacer&) = delete;
+    Replacer& operator=(const Replacer&) = delete;
+    ~Replacer();
+
+    // the rows once they're built, nullopt before
+    std::optional<Replacement> take();
+    // rows searched and rebuilt so far
+    int rowsDone() const;
+
+  private:
+    std::mutex m_mutex;
+    std::optional<Replacement> m_result;
+    std::atomic<bool> m_cancel{false};
+    std::atomic<int> m_rowsDone{0};
+    std::thread m_thread;
+};
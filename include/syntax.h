@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "grammar.h"
+
+enum EditorHighlight
+{
+    HL_NORMAL = 0,
+    HL_COMMENT,
+    HL_MLCOMMENT,
+    HL_KEYWORD1,
+    HL_KEYWORD2,
+    HL_STRING,
+    HL_NUMBER,
+    HL_MATCH,
+};
+
+// A stretch of a row's render in one highlight class. A row's runs are sorted
+// and don't overlap; characters no run covers are HL_NORMAL.
+struct HighlightRun
+{
+    std::uint32_t start;
+    std::uint32_t length : 24;
+    std::uint32_t hl : 8;
+};
+using HighlightRuns = std::vector<HighlightRun>;
+
+// highlighter state carried from the end of one row into the next; a row
+// ending inside a multi-line region carries the region's index plus one
+#define HL_STATE_NORMAL 0
+
+#define HL_HIGHLIGHT_NUMBERS (1 << 0)
+
+struct EditorSyntax
+{
+    std::string_view filetype;
+    std::span<const std::string_view> filematch;
+    std::span<const std::string_view> keywords;
+    std::span<const SyntaxRegion> regions;
+    // compiled from keywords and regions
+    const GrammarTables* tables;
+    int flags;
+};
+
+// every filetype the editor knows how to highlight
+std::span<const EditorSyntax> syntaxDatabase();
+
+bool isSeparator(int c);
+
+// fills highlight with the runs of render that aren't HL_NORMAL, starting in
+// startState; returns the state the line ends in
+int syntaxHighlightLine(const EditorSyntax& syntax, std::string_view render, int startState, HighlightRuns& highlight);
+
+// Where the highlighter stands between two tokens of a line, all it needs to
+// carry on from there. Long lines are highlighted a span at a time from these.
+struct SyntaxCheckpoint
+{
+    std::uint32_t pos;
+    // open region, -1 outside of one
+    std::int16_t region;
+    bool prevSeparator;
+    // a digit or '.' at pos continues a number
+    bool inNumber;
+
+    bool operator==(const SyntaxCheckpoint&) const = default;
+};
+
+// checkpoint at the beginning of a line starting in startState
+SyntaxCheckpoint syntaxLineStart(int startState);
+
+// appends the runs of render from at up to the first token boundary at or
+// after until, or the end of the line, and moves at there
+void syntaxHighlightSpan(const EditorSyntax& syntax, std::string_view render, SyntaxCheckpoint& at, std::size_t until,
+                         HighlightRuns& highlight);
+
+// state a line ends in when the highlighter stopped at end, the end of it
+int syntaxEndState(const EditorSyntax& syntax, const SyntaxCheckpoint& end);
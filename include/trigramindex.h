@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "lineindex.h"
+
+// Which blocks of a file's lines contain each three byte sequence, so a search
+// only has to scan the blocks that hold every trigram of its query. A posting
+// list keeps its block numbers as varint deltas; trigrams found in most blocks
+// are only marked common, as they would rule nothing out.
+//
+// The index covers the file as it was opened. Rows loaded from it or typed
+// since are searched directly, so editing never leaves the index stale.
+class TrigramIndex
+{
+  public:
+    // consecutive lines in a block
+    static constexpr std::size_t BLOCK_LINES{64};
+
+    // indexes lines of data; null when cancel was set before it was done
+    static std::unique_ptr<TrigramIndex> build(std::string_view data, const LineIndex& lines,
+                                               const std::atomic<bool>& cancel);
+
+    // blocks in ascending order that may hold a match of query, nullopt when
+    // the index can't narrow it down: it's shorter than a trigram or all of
+    // its trigrams are common
+    std::optional<std::vector<std::uint32_t>> candidates(std::string_view query) const;
+
+    // bytes taken by the posting lists and the table of trigrams
+    std::size_t memoryUsage() const;
+
+    std::size_t trigrams() const
+    {
+        return m_keys.size();
+    }
+
+  private:
+    struct Postings
+    {
+        std::vector<std::uint8_t> deltas;
+        std::uint32_t last{0};
+        std::uint32_t count{0};
+        bool common{false};
+    };
+
+    std::vector<std::uint32_t> decode(const Postings& postings) const;
+
+    // sorted trigrams, each with its postings at the same index
+    std::vector<std::uint32_t> m_keys;
+    std::vector<Postings> m_postings;
+};
+
+// Builds a TrigramIndex on a background thread.
+class TrigramIndexer
+{
+  public:
+    // data and lines must outlive the indexer; notify is called from the
+    // thread once the index is built
+    TrigramIndexer(std::string_view data, const LineIndex& lines, std::function<void()> notify);
+    TrigramIndexer(const TrigramIndexer&) = delete;
+    TrigramIndexer& operator=(const TrigramIndexer&) = delete;
+    // stops a build that's still running
+    ~TrigramIndexer();
+
+    // the index once it's built, null before
+    std::unique_ptr<TrigramIndex> take();
+
+  private:
+    std::atomic<bool> m_cancel{false};
+    std::mutex m_mutex;
+    std::unique_ptr<TrigramIndex> m_index;
+    std::thread m_thread;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// codepoint shown in place of bytes that aren't valid UTF-8
+#define UNICODE_REPLACEMENT 0xfffd
+
+// true when text has no byte above 0x7f, checked 64 bytes at a time
+bool isAscii(std::string_view text);
+
+// decodes the character at the start of text, returns how many bytes it takes;
+// a byte that doesn't start a valid sequence takes 1 and decodes to
+// UNICODE_REPLACEMENT
+int utf8Decode(std::string_view text, char32_t& codepoint);
+
+// bytes in the sequence lead starts, 1 when it can't start one
+int utf8Length(unsigned char lead);
+
+inline bool utf8Continuation(unsigned char c)
+{
+    return (c & 0xc0) == 0x80;
+}
+
+// columns a terminal gives codepoint: 2 for East Asian wide and fullwidth
+// characters, 0 for combining marks and other characters drawn over the one
+// before, 1 for the rest
+int codepointWidth(char32_t codepoint);
+
+// UTF-8 bytes of codepoint packed little-endian, the way Cell holds a glyph
+std::uint32_t utf8Pack(char32_t codepoint);
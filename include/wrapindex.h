@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "lineindex.h"
+
+// Measures the lines of a file for soft wrap on a background thread, giving
+// the running total of screen lines before each line that unloaded rows are
+// weighed by. The lines are split across threads.
+class WrapIndexer
+{
+  public:
+    // screen lines a line takes; called from several threads at once
+    using Measure = std::function<int(std::string_view line)>;
+
+    // data and lines must outlive the indexer; notify is called from the
+    // thread once every line is measured
+    WrapIndexer(std::string_view data, const LineIndex& lines, Measure measure, std::function<void()> notify);
+    WrapIndexer(const WrapIndexer&) = delete;
+    WrapIndexer& operator=(const WrapIndexer&) = delete;
+    // stops a build that's still running
+    ~WrapIndexer();
+
+    // the totals once they're built, one per line and one for the end,
+    // nullopt before
+    std::optional<std::vector<std::uint32_t>> take();
+
+  private:
+    std::atomic<bool> m_cancel{false};
+    std::mutex m_mutex;
+    std::optional<std::vector<std::uint32_t>> m_totals;
+    std::thread m_thread;
+};
@@ -0,0 +1,121 @@
+#include "highlighter.h"
+
+namespace
+{
+
+// how many rows a background batch runs before checking for urgent work
+constexpr std::size_t PREEMPT_INTERVAL{64};
+
+} // namespace
+
+HighlightWorker::HighlightWorker(std::function<void()> notify) : m_notify{std::move(notify)}
+{
+    m_thread = std::thread{&HighlightWorker::run, this};
+}
+
+HighlightWorker::~HighlightWorker()
+{
+    {
+        std::lock_guard lock{m_mutex};
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void HighlightWorker::submit(std::shared_ptr<HighlightBatch> batch)
+{
+    {
+        std::lock_guard lock{m_mutex};
+        if (batch->urgent)
+        {
+            m_urgent.push_back(std::move(batch));
+            m_urgentPending = true;
+        }
+        else
+        {
+            m_background.push_back(std::move(batch));
+        }
+    }
+    m_wake.notify_one();
+}
+
+void HighlightWorker::cancelAll()
+{
+    std::lock_guard lock{m_mutex};
+    m_urgent.clear();
+    m_background.clear();
+    m_urgentPending = false;
+}
+
+std::vector<std::shared_ptr<HighlightBatch>> HighlightWorker::takeFinished()
+{
+    std::lock_guard lock{m_mutex};
+    return std::exchange(m_finished, {});
+}
+
+void HighlightWorker::run()
+{
+    while (true)
+    {
+        std::shared_ptr<HighlightBatch> batch;
+        {
+            std::unique_lock lock{m_mutex};
+            m_wake.wait(lock, [this] { return m_stop || !m_urgent.empty() || !m_background.empty(); });
+            if (m_stop)
+                return;
+
+            std::deque<std::shared_ptr<HighlightBatch>>& queue = m_urgent.empty() ? m_background : m_urgent;
+            batch = std::move(queue.front());
+            queue.pop_front();
+            m_urgentPending = !m_urgent.empty();
+        }
+
+        HighlightBatch& b = *batch;
+        std::size_t count = b.items.size();
+        b.startStates.resize(count);
+        b.endStates.resize(count);
+        b.highlights.resize(count);
+
+        int state = b.processed ? b.endStates[b.processed - 1] : b.startState;
+        bool preempted = false;
+        HighlightRuns scratch;
+        for (std::size_t& i = b.processed; i < count; ++i)
+        {
+            const HighlightBatch::Item& item = b.items[i];
+            if (b.stopWhenConverged && i > 0 && state == item.previousStartState)
+            {
+                b.converged = true;
+                break;
+            }
+
+            if (!b.urgent && i % PREEMPT_INTERVAL == 0 && m_urgentPending)
+            {
+                preempted = true;
+                break;
+            }
+
+            b.startStates[i] = state;
+            if (item.wantHighlight)
+            {
+                state = syntaxHighlightLine(*b.syntax, item.text, state, b.highlights[i]);
+            }
+            else
+            {
+                // only the end state matters for rows nobody is looking at
+                state = syntaxHighlightLine(*b.syntax, item.text, state, scratch);
+            }
+            b.endStates[i] = state;
+        }
+
+        {
+            std::lock_guard lock{m_mutex};
+            if (preempted)
+                m_background.push_front(std::move(batch));
+            else
+                m_finished.push_back(std::move(batch));
+        }
+        if (!preempted)
+            m_notify();
+    }
+}
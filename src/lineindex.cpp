@@ -0,0 +1,206 @@
+#include "lineindex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include "parallel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KILO_X86 1
+#endif
+
+namespace
+{
+
+// below this a chunk is not worth a thread
+constexpr std::size_t MIN_CHUNK_SIZE{4u << 20};
+
+constexpr int CRLF_SHIFT{63};
+
+// Every scanner appends, for each '\n' at position p in [begin, end), the
+// start of the following line p + 1 tagged with whether the newline was
+// preceded by '\r'. data is the whole buffer so the byte before begin can be
+// inspected.
+using Scanner = void (*)(const char* data, std::size_t begin, std::size_t end, std::vector<std::uint64_t>& out);
+
+void scanScalar(const char* data, std::size_t begin, std::size_t end, std::vector<std::uint64_t>& out)
+{
+    const char* p = data + begin;
+    const char* last = data + end;
+    while ((p = static_cast<const char*>(std::memchr(p, '\n', last - p))))
+    {
+        std::uint64_t crlf = p > data && p[-1] == '\r';
+        ++p;
+        out.push_back(static_cast<std::uint64_t>(p - data) | (crlf << CRLF_SHIFT));
+    }
+}
+
+// emits the newlines of one 64 byte block starting at base
+inline void emitBlock(std::uint64_t newlines, std::uint64_t crBefore, std::size_t base, std::vector<std::uint64_t>& out)
+{
+    while (newlines)
+    {
+        int bit = __builtin_ctzll(newlines);
+        std::uint64_t crlf = (crBefore >> bit) & 1;
+        out.push_back((base + bit + 1) | (crlf << CRLF_SHIFT));
+        newlines &= newlines - 1;
+    }
+}
+
+#ifdef KILO_X86
+void scanSse2(const char* data, std::size_t begin, std::size_t end, std::vector<std::uint64_t>& out)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+
+    std::uint64_t carry = begin > 0 && data[begin - 1] == '\r';
+    std::size_t i{begin};
+    for (; i + 64 <= end; i += 64)
+    {
+        std::uint64_t newlines{0};
+        std::uint64_t returns{0};
+        for (int k{0}; k < 4; ++k)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16 * k));
+            newlines |= static_cast<std::uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl))) << (16 * k);
+            returns |= static_cast<std::uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, cr))) << (16 * k);
+        }
+
+        emitBlock(newlines, (returns << 1) | carry, i, out);
+        carry = returns >> 63;
+    }
+    scanScalar(data, i, end, out);
+}
+
+__attribute__((target("avx2"))) void scanAvx2(const char* data, std::size_t begin, std::size_t end,
+                                              std::vector<std::uint64_t>& out)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+
+    std::uint64_t carry = begin > 0 && data[begin - 1] == '\r';
+    std::size_t i{begin};
+    for (; i + 64 <= end; i += 64)
+    {
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+
+        std::uint64_t newlines = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl))) |
+                                 static_cast<std::uint64_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl))) << 32;
+        std::uint64_t returns = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, cr))) |
+                                static_cast<std::uint64_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, cr))) << 32;
+
+        emitBlock(newlines, (returns << 1) | carry, i, out);
+        carry = returns >> 63;
+    }
+    scanScalar(data, i, end, out);
+}
+#endif
+
+Scanner pickScanner(ScanKernel kernel)
+{
+#ifdef KILO_X86
+    if (kernel == ScanKernel::Auto)
+        kernel = __builtin_cpu_supports("avx2") ? ScanKernel::Avx2 : ScanKernel::Sse2;
+
+    switch (kernel)
+    {
+    case ScanKernel::Avx2:
+        return scanAvx2;
+    case ScanKernel::Sse2:
+        return scanSse2;
+    default:
+        return scanScalar;
+    }
+#else
+    return scanScalar;
+#endif
+}
+
+} // namespace
+
+bool LineIndex::kernelSupported(ScanKernel kernel)
+{
+    switch (kernel)
+    {
+#ifdef KILO_X86
+    case ScanKernel::Avx2:
+        return __builtin_cpu_supports("avx2");
+    case ScanKernel::Sse2:
+        return true;
+#else
+    case ScanKernel::Avx2:
+    case ScanKernel::Sse2:
+        return false;
+#endif
+    default:
+        return true;
+    }
+}
+
+LineIndex LineIndex::build(std::string_view data, unsigned threads, ScanKernel kernel)
+{
+    LineIndex index;
+    if (data.empty())
+        return index;
+
+    Scanner scan = pickScanner(kernel);
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t chunkCount = std::clamp<std::size_t>(data.size() / MIN_CHUNK_SIZE, 1, threads);
+    std::size_t chunkSize = data.size() / chunkCount;
+
+    // index every chunk on its own thread, then stitch the per-chunk tables
+    // together; offsets are absolute so the stitch is a plain copy
+    std::vector<std::vector<std::uint64_t>> chunks(chunkCount);
+    parallelFor(chunkCount, [&](unsigned i) {
+        std::size_t begin = i * chunkSize;
+        std::size_t end = i + 1 == chunkCount ? data.size() : begin + chunkSize;
+        chunks[i].reserve((end - begin) / 64);
+        scan(data.data(), begin, end, chunks[i]);
+    });
+
+    std::vector<std::size_t> position(chunkCount + 1);
+    position[0] = 1;
+    for (std::size_t i{0}; i < chunkCount; ++i)
+    {
+        position[i + 1] = position[i] + chunks[i].size();
+    }
+
+    // a file ending in '\n' already produced its sentinel, otherwise the last
+    // line runs to the end of the buffer
+    bool endsInNewline = data.back() == '\n';
+    index.m_starts.resize(position[chunkCount] + !endsInNewline);
+    index.m_starts[0] = 0;
+    if (!endsInNewline)
+        index.m_starts.back() = data.size();
+
+    parallelFor(chunkCount, [&](unsigned i) {
+        std::copy(chunks[i].begin(), chunks[i].end(), index.m_starts.begin() + position[i]);
+        std::vector<std::uint64_t>().swap(chunks[i]);
+    });
+
+    return index;
+}
+
+std::size_t LineIndex::lineAt(std::size_t offset) const
+{
+    return lineAt(offset, 0);
+}
+
+std::size_t LineIndex::lineAt(std::size_t offset, std::size_t from) const
+{
+    std::size_t step{1};
+    while (from + step < m_starts.size() && start(from + step) <= offset)
+    {
+        from += step;
+        step *= 2;
+    }
+    auto last = m_starts.begin() + std::min(from + step, m_starts.size());
+    auto after = std::ranges::upper_bound(m_starts.begin() + from, last, offset, {},
+                                          [](std::uint64_t start) { return start & OFFSET_MASK; });
+    return after - m_starts.begin() - 1;
+}
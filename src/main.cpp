@@ -1,27 +1,78 @@
 #include <algorithm>
+#include <array>
 #include <cctype>
+#include <chrono>
+#include <csignal>
 #include <cstdarg>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <errno.h>
 #include <format>
+#include <fcntl.h>
 #include <fstream>
-#include <span>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <poll.h>
 #include <string>
 #include <string_view>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "highlighter.h"
+#include "lineindex.h"
+#include "mappedfile.h"
+#include "regexmatcher.h"
+#include "rowarena.h"
+#include "rowtree.h"
+#include "screen.h"
+#include "search.h"
+#include "syntax.h"
+#include "trigramindex.h"
+#include "unicode.h"
+#include "wrapindex.h"
 
 #define KILO_VERSION "0.0.1"
 #define CTRL_KEY(k) ((k) & 0x1f)
 #define KILO_TAB_STOP 8
 #define KILO_QUIT_TIMES 3
+#define KILO_ESCAPE_TIMEOUT_MS 50
+#define KILO_STATUS_MESSAGE_SECONDS 5
+// rows handed to the highlight worker at a time when catching up in the background
+#define KILO_HIGHLIGHT_BATCH_ROWS 4096
+// idle time after which a fragmented row arena is compacted
+#define KILO_COMPACT_DELAY_MS 1000
+// rows with at least this many render columns are highlighted a chunk at a
+// time, and on an edit only as far as the screen shows
+#define KILO_LONG_ROW 65536
+// render columns between highlighter checkpoints in a long row
+#define KILO_LONG_ROW_CHUNK 4096
+// idle time after which the rest of a long row being edited is highlighted
+#define KILO_LONG_ROW_DELAY_MS 300
+// files at least this large get a trigram index for find, built in the
+// background after opening; smaller ones scan faster than it narrows
+#define KILO_TRIGRAM_MIN_BYTES (64 << 20)
 
 /* forward declarations */
 void editorSetStatusMessage(std::string_view fmt, ...);
 void editorRefreshScreen();
-std::string editorPrompt(std::string&& prompt, void (*callback)(std::string_view, int));
+bool editorWaitForInput(int timeoutMs, bool (*done)() = nullptr);
+void editorCollectHighlights();
+void editorCollectSearch();
+void editorCollectTrigrams();
+void editorCollectReplace();
+void editorCollectWrap();
+void editorSetWrap(bool wrap);
+void editorUpdateWrap(int at);
+void editorVisibleRows(int& top, int& bottom);
+std::optional<std::string> editorPrompt(std::string&& prompt, void (*callback)(std::string_view, int),
+                                        bool allowEmpty = false);
 
 enum EditorKey
 {
@@ -35,73 +86,175 @@ enum EditorKey
     END_KEY,
     PAGE_UP,
     PAGE_DOWN,
+    PASTE,
 };
 
-enum EditorHighlight
-{
-    HL_NORMAL = 0,
-    HL_COMMENT,
-    HL_KEYWORD1,
-    HL_KEYWORD2,
-    HL_STRING,
-    HL_NUMBER,
-    HL_MATCH,
-};
-
-#define HL_HIGHLIGHT_NUMBERS (1 << 0)
-#define HL_HIGHLIGHT_STIRNGS (1 << 1)
+// parts of the frame that have to be recomposed on the next refresh
+#define REDRAW_CONTENT (1 << 0)
+#define REDRAW_VIEWPORT (1 << 1)
+#define REDRAW_STATUS (1 << 2)
+#define REDRAW_CURSOR (1 << 3)
+#define REDRAW_ALL (REDRAW_CONTENT | REDRAW_VIEWPORT | REDRAW_STATUS | REDRAW_CURSOR)
 
 /* data */
 
-struct EditorSyntax
+// A character that doesn't take one byte in chars, one in the render and one
+// column on screen: a tab, rendered as spaces up to the next tab stop, or a
+// multibyte UTF-8 sequence, which can be 0 to 2 columns wide.
+struct Glyph
 {
-    std::string filetype;
-    std::span<const std::string_view> filematch;
-    std::span<const std::string_view> keywords;
-    std::string singleLineCommentStart;
-    int flags;
+    // where it starts in chars, in the render and on screen
+    int cx;
+    int rx;
+    int column;
+    // bytes in chars
+    std::uint8_t size;
+    // columns on screen, for a tab also the spaces it renders as
+    std::uint8_t width;
+    bool tab;
 };
+using GlyphMap = std::vector<Glyph>;
 
 struct erow
 {
-    std::string chars;
+    // allocated from E.arena
+    std::pmr::string chars;
+    // chars with tabs expanded, built by editorRowRender the first time it's
+    // needed; rows without tabs never get one
     std::string render;
-    std::string highlight;
+    // the row's glyphs in order, null for plain ASCII without tabs; maps
+    // between chars, render and screen columns without decoding the row, so
+    // the widths of a row's characters are only looked up when it changes
+    std::unique_ptr<GlyphMap> glyphs;
+    // tabs and double width characters among glyphs
+    int tabs{0};
+    int wide{0};
+    HighlightRuns highlight;
+    int hlStartState{HL_STATE_NORMAL};
+    // HL_STATE_UNKNOWN while a long row is highlighted only part of the way
+    int hlEndState{HL_STATE_NORMAL};
+    // highlight was computed from render and hlStartState; until then the row
+    // is drawn without colours
+    bool hlValid{false};
+    // where the highlighter stood every KILO_LONG_ROW_CHUNK columns or so of
+    // a long row, up to where its highlight goes; null for other rows
+    std::unique_ptr<std::vector<SyntaxCheckpoint>> hlCheckpoints;
+    // changes whenever render or highlight does, unique across rows
+    std::uint64_t stamp{0};
+};
+
+// cells a screen row was last composed from, reused while the row, its
+// stamp and the horizontal scroll stay the same
+struct DrawCache
+{
+    const erow* row{nullptr};
+    std::uint64_t stamp{0};
+    int coloffset{0};
+    std::vector<Cell> cells;
+};
+
+struct EditorTimer
+{
+    std::chrono::steady_clock::time_point deadline;
+    void (*callback)();
 };
 
 struct EditorConfig
 {
     int cursorX, cursorY;
+    // screen column of the cursor in its row
     int renderX;
+    // cursor in screen lines from the top of the buffer and columns from the
+    // start of its screen line; cursorY and renderX unless wrapping
+    int visualY, visualX;
+    // first screen line shown, the same as the first row unless wrapping
     int rowoffset;
     int coloffset;
     int screenrows;
     int screencols;
     int numrows;
-    std::vector<erow> row;
+    // declared before row so it outlives the text allocated from it
+    std::unique_ptr<RowArena> arena;
+    RowTree<erow> row;
+    MappedFile file;
+    LineIndex lines;
+    Screen screen;
     int dirty;
     std::string filename;
     std::string statusmsg;
     std::time_t statusmsg_time;
+    int redraw;
+    // counts the matches of the find prompt's query in the background
+    std::unique_ptr<SearchWorker> searcher;
+    // the find prompt is open, the search worker reads rows in place meanwhile
+    bool searching;
+    // the find prompt takes its query as a regex, switched with Ctrl-R; the
+    // regex compiled from the query, or why it doesn't compile
+    bool searchRegex;
+    std::unique_ptr<RegexMatcher> regex;
+    std::string regexError;
+    // query typed into the find prompt and its matches, null until the worker
+    // has counted them
+    std::string searchQuery;
+    std::shared_ptr<const SearchResult> matches;
+    // where the matches are in the rows drawn or stepped to, each row matched
+    // once for the result rowMatchesOf
+    std::shared_ptr<const SearchResult> rowMatchesOf;
+    std::unordered_map<int, std::vector<RegexMatch>> rowMatches;
+    // the current match, matchRow -1 for none: its place among matches, and
+    // where it is in the render; drawn over the row's highlight with the
+    // other matches in view
+    std::size_t matchIndex;
+    int matchRow;
+    int matchStart;
+    int matchEnd;
+    // a replace all running in the background, it reads rows in place, and
+    // the rows it changed once it's done
+    std::unique_ptr<Replacer> replacer;
+    std::optional<Replacement> replaced;
+    std::vector<DrawCache> drawCache;
+    std::uint64_t rowStamp;
     const EditorSyntax* syntax;
     termios original_termios;
+    std::string input;
+    std::size_t inputPos;
+    std::string paste;
+    int wakeupPipe[2];
+    std::vector<EditorTimer> timers;
+    std::unique_ptr<HighlightWorker> highlighter;
+    // soft wrap: rows are broken into screen lines and weighted in row by
+    // how many they take
+    bool wrap;
+    // screen lines taken by the lines in the mapped file before each one,
+    // empty while wrapIndexer measures them
+    std::vector<std::uint32_t> wrapSource;
+    // bumped whenever rows shift or states are invalidated, results of
+    // batches submitted before are dropped
+    std::uint64_t hlGeneration;
+    // first row whose start state may be stale, -1 when all are up to date
+    int hlDirtyFrom;
+    // state row hlDirtyFrom starts in, -1 to take it from the row above
+    int hlDirtyState;
+    // last row invalidated since, the pass from hlDirtyFrom doesn't stop
+    // before it where the states agree again
+    int hlDirtyTo;
+    bool hlUrgentBusy;
+    bool hlBackgroundBusy;
+    // long row whose highlight stops short of its end, -1 for none
+    int hlPartialRow;
+    // start states of the lines in the mapped file, HL_STATE_UNKNOWN until the
+    // worker gets to them
+    std::vector<std::uint8_t> sourceStates;
+    // trigram index of the mapped file for find, null until built; declared
+    // after file and lines so the indexer stops before they go
+    std::unique_ptr<TrigramIndex> trigrams;
+    std::unique_ptr<TrigramIndexer> indexer;
+    // measures the file's lines for wrapSource at the current width, null
+    // once it's done; declared after file and lines for the same reason
+    std::unique_ptr<WrapIndexer> wrapIndexer;
 };
 EditorConfig E;
 
-/* filetypes */
-
-constexpr std::array<std::string_view, 3> C_HL_extensions{".c", ".h", ".cpp"};
-constexpr std::array<std::string_view, 23> C_HL_keywords{
-    "switch", "if",      "while",   "for",    "break",     "continue", "return", "else",
-    "struct", "union",   "typedef", "static", "enum",      "class",    "case",   "int|",
-    "long|",  "double|", "float|",  "char|",  "unsigned|", "signed|",  "void|"};
-
-constexpr std::array<EditorSyntax, 1> HLDB{{
-    {"c", C_HL_extensions, C_HL_keywords, "//", HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STIRNGS},
-}};
-
-constexpr int HLDB_ENTRIES{HLDB.size()};
-
 /* terminal */
 void die(const char* s)
 {
@@ -111,6 +264,7 @@ void die(const char* s)
 
 void disableRawMode()
 {
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.original_termios) == -1)
         die("tcsetattr");
 }
@@ -127,106 +281,187 @@ void enableRawMode()
     raw.c_oflag &= ~(OPOST);
     raw.c_cflag |= (CS8);
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    // reads never block, the event loop waits in poll() instead
     raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 1;
+    raw.c_cc[VTIME] = 0;
 
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
         die("tcsetattr");
+
+    // have pastes wrapped in ESC [200~ ... ESC [201~ so they arrive as one key
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
-int editorReadKey()
+// decodes the key at the front of buf into key and returns the number of bytes
+// it takes, or 0 if buf only holds the start of an escape sequence
+std::size_t editorDecodeKey(std::string_view buf, int& key)
 {
-    int nread;
-    char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1)
-    {
-        if (nread == -1 && errno != EAGAIN)
-            die("read");
-    }
+    key = static_cast<unsigned char>(buf[0]);
+    if (key != '\x1b')
+        return 1;
+
+    if (buf.size() < 2)
+        return 0;
 
-    if (c == '\x1b')
+    if (buf[1] == '[')
     {
-        char seq[3];
-        if (read(STDIN_FILENO, &seq[0], 1) != 1)
-            return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1)
-            return '\x1b';
-        if (seq[0] == '[')
+        std::size_t end{2};
+        while (end < buf.size() && (std::isdigit(static_cast<unsigned char>(buf[end])) || buf[end] == ';'))
         {
-            if (seq[1] >= '0' && seq[1] <= '9')
-            {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1)
-                    return '\x1b';
-                if (seq[2] == '~')
-                {
-                    switch (seq[1])
-                    {
-                    case '1':
-                        return HOME_KEY;
-                    case '3':
-                        return DEL_KEY;
-                    case '4':
-                        return END_KEY;
-                    case '5':
-                        return PAGE_UP;
-                    case '6':
-                        return PAGE_DOWN;
-                    case '7':
-                        return HOME_KEY;
-                    case '8':
-                        return END_KEY;
-                    }
-                }
-            }
-            else
+            ++end;
+        }
+        if (end == buf.size())
+            return 0;
+
+        std::string_view params = buf.substr(2, end - 2);
+        if (buf[end] == '~')
+        {
+            if (params == "1" || params == "7")
+                key = HOME_KEY;
+            else if (params == "3")
+                key = DEL_KEY;
+            else if (params == "4" || params == "8")
+                key = END_KEY;
+            else if (params == "5")
+                key = PAGE_UP;
+            else if (params == "6")
+                key = PAGE_DOWN;
+            else if (params == "200")
             {
-                switch (seq[1])
-                {
-                case 'A':
-                    return ARROW_UP;
-                case 'B':
-                    return ARROW_DOWN;
-                case 'C':
-                    return ARROW_RIGHT;
-                case 'D':
-                    return ARROW_LEFT;
-                case 'H':
-                    return HOME_KEY;
-                case 'F':
-                    return END_KEY;
-                }
+                // bracketed paste: everything up to the end marker is text
+                std::size_t pasteEnd = buf.find("\x1b[201~", end + 1);
+                if (pasteEnd == std::string_view::npos)
+                    return 0;
+
+                E.paste.assign(buf.substr(end + 1, pasteEnd - end - 1));
+                key = PASTE;
+                return pasteEnd + 6;
             }
         }
-        else if (seq[0] == 'O')
+        else if (params.empty())
         {
-            switch (seq[1])
+            switch (buf[end])
             {
+            case 'A':
+                key = ARROW_UP;
+                break;
+            case 'B':
+                key = ARROW_DOWN;
+                break;
+            case 'C':
+                key = ARROW_RIGHT;
+                break;
+            case 'D':
+                key = ARROW_LEFT;
+                break;
             case 'H':
-                return HOME_KEY;
+                key = HOME_KEY;
+                break;
             case 'F':
-                return END_KEY;
+                key = END_KEY;
+                break;
             }
         }
-        return '\x1b';
+        return end + 1;
     }
-    else
+
+    if (buf[1] == 'O')
+    {
+        if (buf.size() < 3)
+            return 0;
+        if (buf[2] == 'H')
+            key = HOME_KEY;
+        else if (buf[2] == 'F')
+            key = END_KEY;
+        return 3;
+    }
+
+    return 2;
+}
+
+// true when a key has already been read and is waiting to be decoded
+bool editorKeyPending()
+{
+    return E.inputPos < E.input.size();
+}
+
+// true when the next pending key is plain text that can be inserted in bulk
+bool editorTextPending()
+{
+    if (!editorKeyPending())
+        return false;
+
+    unsigned char c = E.input[E.inputPos];
+    return c >= 32 && c != 127;
+}
+
+// drops the next count bytes of pending input, emptying the buffer once it's
+// all been decoded
+void editorConsumeInput(std::size_t count)
+{
+    E.inputPos += count;
+    if (E.inputPos == E.input.size())
+    {
+        E.input.clear();
+        E.inputPos = 0;
+    }
+}
+
+// takes everything the terminal has sent so far in a single read
+void editorReadInput()
+{
+    char buf[65536];
+    int nread = read(STDIN_FILENO, buf, sizeof(buf));
+    if (nread == -1 && errno != EAGAIN && errno != EINTR)
+        die("read");
+
+    if (nread > 0)
+    {
+        E.input.append(buf, nread);
+    }
+}
+
+int editorReadKey()
+{
+    while (true)
     {
-        return c;
+        std::string_view pending{E.input};
+        pending.remove_prefix(E.inputPos);
+
+        int key;
+        std::size_t used = pending.empty() ? 0 : editorDecodeKey(pending, key);
+        if (used)
+        {
+            editorConsumeInput(used);
+            return key;
+        }
+
+        // a partial escape sequence only gets a short grace period, a paste
+        // in progress and an empty buffer wait for as long as it takes
+        bool escapePending = !pending.empty() && !pending.starts_with("\x1b[200~");
+        if (!editorWaitForInput(escapePending ? KILO_ESCAPE_TIMEOUT_MS : -1))
+        {
+            // nothing more arrived, a lone escape was the escape key
+            editorConsumeInput(1);
+            return '\x1b';
+        }
+
+        editorReadInput();
     }
 }
 
 int getCursorPosition(int& rows, int& cols)
 {
-    std::string buf;
-    buf.reserve(32);
+    char buf[32];
 
     if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4)
         return -1;
 
-    unsigned int i;
+    unsigned int i{0};
     while (i < sizeof(buf) - 1)
     {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1)
+        pollfd stdinFd{STDIN_FILENO, POLLIN, 0};
+        if (poll(&stdinFd, 1, 1000) != 1 || read(STDIN_FILENO, &buf[i], 1) != 1)
             break;
         if (buf[i] == 'R')
             break;
@@ -260,295 +495,1529 @@ int getWindowSize(int& rows, int& cols)
     }
 }
 
-/* helpers */
-// replaces a char to a specified string in place, str is an INOUT param
-std::string replaceAll(char from, std::string_view to, std::string& str)
-{
-    std::string newString;
-    for (char& ch : str)
-    {
-        if (ch == from)
-        {
-            newString += to;
-        }
-        else
-        {
-            newString += ch;
-        }
-    }
-    return newString;
-}
+/* event loop */
 
-/* syntax highlighting */
+// Nothing spins: the editor sleeps in poll() on stdin and a self-pipe until a
+// key arrives, a signal or background thread wakes it, or a timer is due.
 
-bool isSeparator(int c)
+#define WAKEUP_RESIZE 'r'
+#define WAKEUP_HIGHLIGHT 'h'
+#define WAKEUP_SEARCH 's'
+#define WAKEUP_INDEX 'i'
+#define WAKEUP_REPLACE 'p'
+#define WAKEUP_WRAP 'w'
+
+void editorWakeup(char reason)
 {
-    return isspace(c) || c == '\0' || std::string_view{",.()+-/*=~%<>[];"}.find(c) != std::string_view::npos;
+    // async-signal-safe, a full pipe already guarantees a wakeup
+    int savedErrno = errno;
+    write(E.wakeupPipe[1], &reason, 1);
+    errno = savedErrno;
 }
-void editorUpdateSyntax(erow& row)
-{
-    row.highlight.assign(row.render.size(), HL_NORMAL);
-
-    if (!E.syntax)
-        return;
 
-    std::string_view scs = E.syntax->singleLineCommentStart;
-    bool isScs = scs.length();
-
-    // initialise to true because we consider the beginning of the line as a separator
-    // otherwise, numbers at the beginning of a line won't be highlighted
-    bool isPrevSeparator = true;
-    int inString = 0;
+void handleSigwinch(int)
+{
+    editorWakeup(WAKEUP_RESIZE);
+}
 
-    int i{0};
-    while (i < row.render.size())
+void editorSetTimer(int delayMs, void (*callback)())
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs);
+    for (EditorTimer& timer : E.timers)
     {
-        char c = row.render[i];
-        unsigned char prevHighlight = (i > 0) ? row.highlight[i - 1] : HL_NORMAL;
-
-        if (isScs && !inString)
-        {
-            if (row.render.substr(i).starts_with(scs))
-            {
-                std::fill(row.highlight.begin() + i, row.highlight.end(), HL_COMMENT);
-                break;
-            }
-        }
-
-        if (E.syntax->flags & HL_HIGHLIGHT_STIRNGS)
+        if (timer.callback == callback)
         {
-            if (inString)
-            {
-                row.highlight[i] = HL_STRING;
-
-                if (c == '\\' && i + 1 < row.render.length())
-                {
-                    row.highlight[i + 1] = HL_STRING;
-                    i += 2;
-                    continue;
-                }
-
-                if (c == inString)
-                {
-                    inString = 0;
-                }
-                i++;
-                isPrevSeparator = true;
-                continue;
-            }
-            else
-            {
-                if (c == '"' || c == '\'')
-                {
-                    inString = c;
-                    row.highlight[i] = HL_STRING;
-                    i++;
-                    continue;
-                }
-            }
+            timer.deadline = deadline;
+            return;
         }
+    }
+    E.timers.push_back({deadline, callback});
+}
 
-        if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS)
-        {
-            if (isdigit(c) && (isPrevSeparator || prevHighlight == HL_NUMBER) ||
-                (c == '.' && prevHighlight == HL_NUMBER))
-            {
-                row.highlight[i] = HL_NUMBER;
-                i++;
-                isPrevSeparator = false;
-                continue;
-            }
-        }
+// milliseconds until the earliest timer is due, -1 when none is set
+int editorNextTimerMs()
+{
+    if (E.timers.empty())
+        return -1;
 
-        isPrevSeparator = isSeparator(c);
-        i++;
-    }
+    auto now = std::chrono::steady_clock::now();
+    auto next = std::min_element(E.timers.begin(), E.timers.end(), [](const EditorTimer& a, const EditorTimer& b) {
+                    return a.deadline < b.deadline;
+                })->deadline;
+    auto ms = std::chrono::ceil<std::chrono::milliseconds>(next - now).count();
+    return std::max<long long>(ms, 0);
 }
 
-int editorSyntaxToColor(int hl)
+void editorRunTimers()
 {
-    switch (hl)
+    auto now = std::chrono::steady_clock::now();
+    std::vector<void (*)()> due;
+    std::erase_if(E.timers, [&](const EditorTimer& timer) {
+        if (timer.deadline > now)
+            return false;
+        due.push_back(timer.callback);
+        return true;
+    });
+
+    for (void (*callback)() : due)
     {
-    case HL_COMMENT:
-        return 36;
-    case HL_KEYWORD1:
-        return 33;
-    case HL_KEYWORD2:
-        return 32;
-    case HL_STRING:
-        return 35;
-    case HL_NUMBER:
-        return 31;
-    case HL_MATCH:
-        return 34;
-    default:
-        return 37;
+        callback();
     }
 }
 
-void editorSelectSyntaxHighlight()
+void editorHandleResize()
 {
-    E.syntax = nullptr;
-    if (E.filename.empty())
+    int rows, cols;
+    if (getWindowSize(rows, cols) == -1 || (rows == E.screenrows + 2 && cols == E.screencols))
         return;
 
-    std::string_view fileExtension{};
-
-    std::size_t idx{E.filename.rfind('.')};
-    if (idx != std::string::npos)
+    E.screen.resize(rows, cols);
+    E.drawCache.clear();
+    E.screenrows = rows - 2;
+    bool rewrap = E.wrap && cols != E.screencols;
+    E.screencols = cols;
+    if (rewrap)
     {
-        fileExtension = {E.filename.begin() + idx, E.filename.end()};
+        editorSetWrap(true);
     }
+    E.redraw = REDRAW_ALL;
+    editorRefreshScreen();
+}
 
-    // Loop over each Language syntax
-    for (const EditorSyntax& syntax : HLDB)
+void editorHandleWakeups()
+{
+    char reasons[64];
+    int nread;
+    while ((nread = read(E.wakeupPipe[0], reasons, sizeof(reasons))) > 0)
     {
-        // Loop over each file extension/type
-        for (const auto& fileType : syntax.filematch)
+        for (int i{0}; i < nread; ++i)
         {
-            bool isExtension = syntax.filematch[0] == ".";
-            if ((isExtension && !(fileExtension.empty()) && fileExtension == fileType) ||
-                (!isExtension && (E.filename.find(fileType) != std::string_view::npos)))
+            switch (reasons[i])
             {
-                E.syntax = &syntax;
-
-                for (auto& filerow : E.row)
-                {
-                    editorUpdateSyntax(filerow);
-                }
-                return;
+            case WAKEUP_RESIZE:
+                editorHandleResize();
+                break;
+            case WAKEUP_HIGHLIGHT:
+                editorCollectHighlights();
+                break;
+            case WAKEUP_SEARCH:
+                editorCollectSearch();
+                break;
+            case WAKEUP_INDEX:
+                editorCollectTrigrams();
+                break;
+            case WAKEUP_REPLACE:
+                editorCollectReplace();
+                break;
+            case WAKEUP_WRAP:
+                editorCollectWrap();
+                break;
             }
         }
     }
 }
 
-/* row operations */
-
-int editorRowCxToRx(erow& row, int cursorX)
+// sleeps until stdin is readable, running timers and wakeups in the meantime;
+// returns false if timeoutMs (-1 for none) passed first, or done returned true
+// after a wakeup
+bool editorWaitForInput(int timeoutMs, bool (*done)())
 {
-    int renderX{0};
-    for (int j{0}; j < cursorX && j < static_cast<int>(row.chars.size()); ++j)
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    while (true)
     {
-        if (row.chars[j] == '\t')
+        int waitMs = editorNextTimerMs();
+        if (timeoutMs >= 0)
         {
-            renderX += (KILO_TAB_STOP - 1) - (renderX & KILO_TAB_STOP);
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            int leftMs = std::max<long long>(left.count(), 0);
+            waitMs = waitMs < 0 ? leftMs : std::min(waitMs, leftMs);
         }
-        renderX++;
+
+        pollfd fds[2]{{STDIN_FILENO, POLLIN, 0}, {E.wakeupPipe[0], POLLIN, 0}};
+        int ready = poll(fds, 2, waitMs);
+        if (ready == -1 && errno != EINTR)
+            die("poll");
+
+        if (ready > 0 && fds[1].revents)
+            editorHandleWakeups();
+        editorRunTimers();
+
+        if (ready > 0 && fds[0].revents)
+            return true;
+        if (done && done())
+            return false;
+        if (timeoutMs >= 0 && std::chrono::steady_clock::now() >= deadline)
+            return false;
     }
-    return renderX;
 }
 
-int editorRowRxToCx(erow& row, int renderX)
+void initEventLoop()
 {
-    int currentRx{0};
-    int cursorX;
-    for (cursorX = 0; cursorX < row.chars.length(); ++cursorX)
+    if (pipe(E.wakeupPipe) == -1)
+        die("pipe");
+    for (int fd : E.wakeupPipe)
     {
-        if (row.chars[cursorX] == '\t')
-        {
-            currentRx = (KILO_TAB_STOP - 1) - (currentRx % KILO_TAB_STOP);
-        }
-        currentRx++;
-
-        if (currentRx > cursorX)
-            return cursorX;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
     }
 
-    return cursorX;
+    struct sigaction sa{};
+    sa.sa_handler = handleSigwinch;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGWINCH, &sa, nullptr) == -1)
+        die("sigaction");
+
+    E.highlighter = std::make_unique<HighlightWorker>([] { editorWakeup(WAKEUP_HIGHLIGHT); });
+    E.searcher = std::make_unique<SearchWorker>([] { editorWakeup(WAKEUP_SEARCH); });
 }
 
-void editorUpdateRow(erow& row)
+/* helpers */
+// replaces a char to a specified string in place, str is an INOUT param
+std::string replaceAll(char from, std::string_view to, std::string& str)
 {
-    row.render.clear();
-    std::string result;
-    int idx{0};
-    for (const char ch : row.chars)
+    std::string newString;
+    for (char& ch : str)
     {
-        if (ch == '\t')
+        if (ch == from)
         {
-            result += ' ';
-            ++idx;
-
-            // fill with spaces until we reach the next tab stop
-            while (idx % KILO_TAB_STOP != 0)
-            {
-                result += ' ';
-                ++idx;
-            }
+            newString += to;
         }
         else
         {
-            result += ch;
-            ++idx;
+            newString += ch;
         }
     }
+    return newString;
+}
 
-    row.render = std::move(result);
-    editorUpdateSyntax(row);
+// render column just past a tab starting at rx
+int tabStopEnd(int rx)
+{
+    return rx + KILO_TAB_STOP - rx % KILO_TAB_STOP;
 }
 
-void editorInsertRow(int at, std::string_view line)
+// where glyph ends, counted in the same way as field
+int glyphEnd(const Glyph& glyph, int Glyph::*field)
 {
-    if (at < 0 || at > E.numrows)
-        return;
+    if (field == &Glyph::cx)
+        return glyph.cx + glyph.size;
+    if (field == &Glyph::column)
+        return glyph.column + glyph.width;
+    return glyph.rx + (glyph.tab ? glyph.width : glyph.size);
+}
 
-    E.row.emplace(E.row.begin() + at, erow{static_cast<std::string>(line), "", ""});
-    editorUpdateRow(E.row[at]);
-    E.numrows++;
-    E.dirty++;
+// the row as drawn: chars itself unless it has tabs
+std::string_view editorRowRender(erow& row)
+{
+    if (!row.tabs)
+        return row.chars;
+
+    if (row.render.empty())
+    {
+        std::size_t pos{0};
+        row.render.reserve(row.chars.size() + KILO_TAB_STOP);
+        for (const Glyph& glyph : *row.glyphs)
+        {
+            if (!glyph.tab)
+                continue;
+            row.render.append(row.chars, pos, glyph.cx - pos);
+            // fill with spaces until we reach the next tab stop
+            row.render.append(glyph.width, ' ');
+            pos = glyph.cx + 1;
+        }
+        row.render.append(row.chars, pos);
+    }
+    return row.render;
+}
+
+/* syntax highlighting */
+
+// Rows are highlighted on a worker thread: the visible rows first, then the
+// rest of the buffer in order so block comments carry through it. Only a row
+// being edited is highlighted on the spot, typing never waits on the worker.
+
+#define HL_STATE_UNKNOWN 0xff
+
+// invalidates what was drawn from the row
+void editorRowChanged(erow& row)
+{
+    row.stamp = ++E.rowStamp;
 }
 
-void editorRowInsertChar(erow& row, int at, int c)
+// highlights a long row on from its last checkpoint, a chunk at a time,
+// until render column until or the end of the row
+void editorExtendRowSyntax(erow& row, std::size_t until)
 {
-    if (at < 0 || at > row.chars.size())
+    std::string_view render = editorRowRender(row);
+    std::vector<SyntaxCheckpoint>& checkpoints = *row.hlCheckpoints;
+    SyntaxCheckpoint at = checkpoints.back();
+    while (at.pos < render.size() && at.pos < until)
     {
-        at = row.chars.size();
+        syntaxHighlightSpan(*E.syntax, render, at, at.pos + KILO_LONG_ROW_CHUNK, row.highlight);
+        checkpoints.push_back(at);
     }
-    row.chars.insert(at, 1, c);
-    editorUpdateRow(row);
-    E.dirty++;
+    if (at.pos >= render.size())
+    {
+        row.hlEndState = syntaxEndState(*E.syntax, at);
+    }
+    editorRowChanged(row);
 }
 
-void editorRowDeleteChar(erow& row, int at)
+void editorUpdateSyntax(erow& row)
 {
-    if (at < 0 || at >= row.chars.length())
+    editorRowChanged(row);
+    row.hlValid = true;
+    if (!E.syntax)
     {
+        row.highlight.clear();
+        row.hlCheckpoints.reset();
+        row.hlEndState = HL_STATE_NORMAL;
         return;
     }
 
-    row.chars.erase(at, 1);
-    editorUpdateRow(row);
-    E.dirty++;
+    std::string_view render = editorRowRender(row);
+    if (render.size() < KILO_LONG_ROW)
+    {
+        row.hlCheckpoints.reset();
+        row.hlEndState = syntaxHighlightLine(*E.syntax, render, row.hlStartState, row.highlight);
+        return;
+    }
+
+    // long rows keep checkpoints so an edit only redoes the chunks around it
+    row.hlCheckpoints = std::make_unique<std::vector<SyntaxCheckpoint>>(1, syntaxLineStart(row.hlStartState));
+    row.highlight.clear();
+    editorExtendRowSyntax(row, std::string_view::npos);
 }
 
-void editorRowAppendString(erow& row, std::string_view str)
+// index of the first run ending after pos, the run across pos split in two
+std::size_t editorSplitRuns(HighlightRuns& runs, std::uint32_t pos)
 {
-    row.chars.append(str);
-    editorUpdateRow(row);
-    E.dirty++;
+    auto run = std::ranges::partition_point(runs, [&](const HighlightRun& r) { return r.start + r.length <= pos; });
+    if (run != runs.end() && run->start < pos)
+    {
+        HighlightRun tail = *run;
+        tail.start = pos;
+        tail.length = run->start + run->length - pos;
+        run->length = pos - run->start;
+        run = runs.insert(std::next(run), tail);
+    }
+    return run - runs.begin();
+}
+
+// Render columns [from, oldEnd) of a long row were replaced with [from,
+// newEnd). Highlights again from a checkpoint ahead of the change until the
+// highlighter lands on an old checkpoint past it in the same state, from
+// where the old highlight still holds, or until the end of the screen; the
+// row is then left partly highlighted.
+void editorUpdateLongRowSyntax(erow& row, int from, int oldEnd, int newEnd)
+{
+    std::string_view render = editorRowRender(row);
+    std::size_t window = std::max(newEnd, E.coloffset + E.screencols);
+    row.hlValid = true;
+    if (!row.hlCheckpoints)
+    {
+        row.hlCheckpoints = std::make_unique<std::vector<SyntaxCheckpoint>>(1, syntaxLineStart(row.hlStartState));
+        row.highlight.clear();
+        row.hlEndState = HL_STATE_UNKNOWN;
+        editorExtendRowSyntax(row, window);
+        return;
+    }
+
+    std::vector<SyntaxCheckpoint>& checkpoints = *row.hlCheckpoints;
+    HighlightRuns& runs = row.highlight;
+    int delta = newEnd - oldEnd;
+
+    // what was highlighted past the change, moved to where it is now
+    auto past = std::ranges::lower_bound(checkpoints, static_cast<std::uint32_t>(oldEnd), {}, &SyntaxCheckpoint::pos);
+    std::vector<SyntaxCheckpoint> oldCheckpoints(past, checkpoints.end());
+    for (SyntaxCheckpoint& checkpoint : oldCheckpoints)
+    {
+        checkpoint.pos += delta;
+    }
+    std::size_t pastRun = editorSplitRuns(runs, oldEnd);
+    HighlightRuns oldRuns(runs.begin() + pastRun, runs.end());
+    for (HighlightRun& run : oldRuns)
+    {
+        run.start += delta;
+    }
+
+    // the token ending at a checkpoint may have looked a few characters past
+    // it, so start one checkpoint further back than the change needs
+    auto ahead = std::ranges::lower_bound(checkpoints, static_cast<std::uint32_t>(from), {}, &SyntaxCheckpoint::pos);
+    std::size_t first = std::max<std::ptrdiff_t>(ahead - checkpoints.begin() - 2, 0);
+    SyntaxCheckpoint at = checkpoints[first];
+    checkpoints.resize(first + 1);
+    runs.resize(editorSplitRuns(runs, at.pos));
+
+    row.hlEndState = HL_STATE_UNKNOWN;
+    std::size_t next{0};
+    for (;;)
+    {
+        if (at.pos >= static_cast<std::uint32_t>(newEnd) && next < oldCheckpoints.size() && oldCheckpoints[next] == at)
+        {
+            checkpoints.insert(checkpoints.end(), oldCheckpoints.begin() + next + 1, oldCheckpoints.end());
+            std::size_t sameRun = editorSplitRuns(oldRuns, at.pos);
+            runs.insert(runs.end(), oldRuns.begin() + sameRun, oldRuns.end());
+            break;
+        }
+        if (at.pos >= render.size() || at.pos >= window)
+            break;
+
+        // stop on the old checkpoints, the only places the two can meet
+        while (next < oldCheckpoints.size() && oldCheckpoints[next].pos <= at.pos)
+        {
+            ++next;
+        }
+        std::size_t until = at.pos + KILO_LONG_ROW_CHUNK;
+        if (next < oldCheckpoints.size())
+        {
+            until = std::min<std::size_t>(until, oldCheckpoints[next].pos);
+        }
+        syntaxHighlightSpan(*E.syntax, render, at, until, runs);
+        checkpoints.push_back(at);
+    }
+
+    if (checkpoints.back().pos >= render.size())
+    {
+        row.hlEndState = syntaxEndState(*E.syntax, checkpoints.back());
+    }
+    editorRowChanged(row);
+}
+
+// end state of row at, rows that are not loaded are assumed to end normally
+int editorRowEndState(int at)
+{
+    std::size_t sourceLine;
+    erow* row = at >= 0 && at < E.numrows ? E.row.peek(at, sourceLine) : nullptr;
+    if (row && row->hlEndState == HL_STATE_UNKNOWN)
+    {
+        // whoever asks deals with the rows below
+        editorExtendRowSyntax(*row, std::string_view::npos);
+    }
+    return row ? row->hlEndState : HL_STATE_NORMAL;
+}
+
+// state row at was last highlighted from, -1 if it never was
+int editorRowStartState(int at)
+{
+    std::size_t sourceLine;
+    if (const erow* row = E.row.peek(at, sourceLine))
+        return row->hlValid ? row->hlStartState : -1;
+    return E.sourceStates[sourceLine] == HL_STATE_UNKNOWN ? -1 : E.sourceStates[sourceLine];
+}
+
+// rows from at on may have been highlighted from a state that no longer holds;
+// drops whatever the worker is busy with and has it start over from there
+void editorInvalidateSyntax(int at)
+{
+    E.hlGeneration++;
+    E.highlighter->cancelAll();
+    E.hlUrgentBusy = false;
+    E.hlBackgroundBusy = false;
+
+    if (!E.syntax)
+        return;
+    if (E.hlDirtyFrom < 0 || at <= E.hlDirtyFrom)
+    {
+        E.hlDirtyFrom = at;
+        E.hlDirtyState = -1;
+    }
+    E.hlDirtyTo = std::max(E.hlDirtyTo, at);
+}
+
+// highlights the rest of the long row an edit left partly highlighted and
+// has the rows below follow its end state
+void editorFinishPartialSyntax()
+{
+    int at = E.hlPartialRow;
+    E.hlPartialRow = -1;
+    if (at < 0 || at >= E.numrows)
+        return;
+
+    std::size_t sourceLine;
+    erow* row = E.row.peek(at, sourceLine);
+    if (!row || row->hlEndState != HL_STATE_UNKNOWN)
+        return;
+
+    editorExtendRowSyntax(*row, std::string_view::npos);
+    if (at + 1 < E.numrows && editorRowStartState(at + 1) != row->hlEndState)
+    {
+        editorInvalidateSyntax(at + 1);
+    }
+    E.redraw |= REDRAW_CONTENT;
+}
+
+// timer callback, once typing in a long row pauses
+void editorFinishPartialSyntaxIdle()
+{
+    editorFinishPartialSyntax();
+    editorRefreshScreen();
+}
+
+// called after row at was edited, inserted or removed: the row itself is
+// re-highlighted right away, the worker takes care of the rows below it
+void editorUpdateSyntaxFrom(int at)
+{
+    if (!E.syntax || at >= E.numrows)
+        return;
+
+    int state = editorRowEndState(at - 1);
+    std::size_t sourceLine;
+    if (erow* row = E.row.peek(at, sourceLine))
+    {
+        if (!row->hlValid || row->hlStartState != state)
+        {
+            row->hlStartState = state;
+            editorUpdateSyntax(*row);
+            E.redraw |= REDRAW_CONTENT;
+        }
+        if (row->hlEndState == HL_STATE_UNKNOWN)
+        {
+            // the rows below wait until typing here pauses
+            if (E.hlPartialRow != at)
+            {
+                editorFinishPartialSyntax();
+            }
+            E.hlPartialRow = at;
+            editorSetTimer(KILO_LONG_ROW_DELAY_MS, editorFinishPartialSyntaxIdle);
+            return;
+        }
+        state = row->hlEndState;
+    }
+
+    if (at + 1 < E.numrows && editorRowStartState(at + 1) != state)
+    {
+        editorInvalidateSyntax(at + 1);
+    }
+}
+
+// appends rows first..last to batch, loaded rows are copied
+void editorAddHighlightRows(HighlightBatch& batch, int first, int last)
+{
+    for (int i{first}; i <= last; ++i)
+    {
+        std::size_t sourceLine;
+        if (erow* row = E.row.peek(i, sourceLine))
+        {
+            batch.add(std::string{editorRowRender(*row)}, row->hlValid ? row->hlStartState : -1);
+        }
+        else
+        {
+            int state = E.sourceStates[sourceLine];
+            batch.addView(E.lines.line(E.file.view(), sourceLine), state == HL_STATE_UNKNOWN ? -1 : state);
+        }
+    }
+}
+
+// hands the worker the visible rows that still lack a highlight and, when
+// nothing on screen is waiting, the next stretch of stale rows
+void editorQueueHighlight()
+{
+    if (!E.syntax)
+        return;
+
+    if (!E.hlUrgentBusy)
+    {
+        int first{-1};
+        int last{-1};
+        int top, bottom;
+        editorVisibleRows(top, bottom);
+        for (int i{top}; i < bottom; ++i)
+        {
+            std::size_t sourceLine;
+            const erow* row = E.row.peek(i, sourceLine);
+            if (row && !row->hlValid)
+            {
+                if (first < 0)
+                    first = i;
+                last = i;
+            }
+        }
+
+        if (first >= 0)
+        {
+            auto batch = std::make_shared<HighlightBatch>();
+            batch->syntax = E.syntax;
+            batch->generation = E.hlGeneration;
+            batch->urgent = true;
+
+            // a row above that is still in the file knows its start state,
+            // running it too gives the first visible row the right one
+            std::size_t sourceLine;
+            if (first > 0 && !E.row.peek(first - 1, sourceLine) && E.sourceStates[sourceLine] != HL_STATE_UNKNOWN)
+            {
+                --first;
+                batch->startState = E.sourceStates[sourceLine];
+            }
+            else
+            {
+                batch->startState = editorRowEndState(first - 1);
+            }
+            batch->firstRow = first;
+            editorAddHighlightRows(*batch, first, last);
+
+            E.hlUrgentBusy = true;
+            E.highlighter->submit(std::move(batch));
+        }
+    }
+
+    if (!E.hlBackgroundBusy && E.hlDirtyFrom >= 0)
+    {
+        if (E.hlDirtyFrom >= E.numrows)
+        {
+            E.hlDirtyFrom = -1;
+            E.hlDirtyTo = -1;
+            return;
+        }
+
+        auto batch = std::make_shared<HighlightBatch>();
+        batch->syntax = E.syntax;
+        batch->generation = E.hlGeneration;
+        batch->firstRow = E.hlDirtyFrom;
+        batch->startState = E.hlDirtyState >= 0 ? E.hlDirtyState : editorRowEndState(E.hlDirtyFrom - 1);
+        batch->stopWhenConverged = true;
+        editorAddHighlightRows(*batch, E.hlDirtyFrom,
+                               std::min(E.hlDirtyFrom + KILO_HIGHLIGHT_BATCH_ROWS, E.numrows) - 1);
+        for (std::size_t i{0}; i < batch->items.size() && E.hlDirtyFrom + static_cast<int>(i) <= E.hlDirtyTo; ++i)
+        {
+            batch->items[i].previousStartState = -1;
+        }
+
+        E.hlBackgroundBusy = true;
+        E.highlighter->submit(std::move(batch));
+    }
+}
+
+// adopts what the worker finished, called when it signals the event loop
+void editorCollectHighlights()
+{
+    bool visible = false;
+    for (const std::shared_ptr<HighlightBatch>& batch : E.highlighter->takeFinished())
+    {
+        // rows moved or states were invalidated since it was submitted
+        if (batch->generation != E.hlGeneration)
+            continue;
+
+        (batch->urgent ? E.hlUrgentBusy : E.hlBackgroundBusy) = false;
+
+        int first = batch->firstRow;
+        int end = first + batch->processed;
+        for (int i{first}; i < end; ++i)
+        {
+            std::size_t k = i - first;
+            std::size_t sourceLine;
+            if (erow* row = E.row.peek(i, sourceLine))
+            {
+                // rows edited meanwhile were highlighted on the spot already
+                const HighlightBatch::Item& item = batch->items[k];
+                if (!item.wantHighlight || editorRowRender(*row) != item.text)
+                    continue;
+
+                row->highlight = std::move(batch->highlights[k]);
+                row->hlCheckpoints.reset();
+                editorRowChanged(*row);
+                row->hlStartState = batch->startStates[k];
+                row->hlEndState = batch->endStates[k];
+                row->hlValid = true;
+            }
+            else
+            {
+                E.sourceStates[sourceLine] = batch->startStates[k];
+            }
+        }
+
+        int top, bottom;
+        editorVisibleRows(top, bottom);
+        if (end > top && first < bottom)
+            visible = true;
+
+        if (!batch->urgent)
+        {
+            if (batch->converged || end >= E.numrows)
+            {
+                E.hlDirtyFrom = -1;
+                E.hlDirtyTo = -1;
+            }
+            else
+            {
+                E.hlDirtyFrom = end;
+                E.hlDirtyState = batch->endStates[batch->processed - 1];
+            }
+        }
+        else if (end < E.numrows)
+        {
+            // the rows below were highlighted assuming another state; unknown
+            // ones are still ahead of the background pass
+            int next = editorRowStartState(end);
+            if (next >= 0 && next != batch->endStates[batch->processed - 1])
+                editorInvalidateSyntax(end);
+        }
+    }
+
+    editorQueueHighlight();
+    if (visible)
+    {
+        E.redraw |= REDRAW_CONTENT;
+        editorRefreshScreen();
+    }
+}
+
+int editorSyntaxToColor(int hl)
+{
+    switch (hl)
+    {
+    case HL_COMMENT:
+    case HL_MLCOMMENT:
+        return 36;
+    case HL_KEYWORD1:
+        return 33;
+    case HL_KEYWORD2:
+        return 32;
+    case HL_STRING:
+        return 35;
+    case HL_NUMBER:
+        return 31;
+    case HL_MATCH:
+        return 34;
+    default:
+        return 37;
+    }
+}
+
+void editorSelectSyntaxHighlight()
+{
+    const EditorSyntax* selected{nullptr};
+
+    std::string_view fileExtension{};
+
+    std::size_t idx{E.filename.rfind('.')};
+    if (idx != std::string::npos)
+    {
+        fileExtension = {E.filename.begin() + idx, E.filename.end()};
+    }
+
+    // Loop over each Language syntax
+    for (const EditorSyntax& syntax : syntaxDatabase())
+    {
+        // Loop over each file extension/type
+        for (const auto& fileType : syntax.filematch)
+        {
+            bool isExtension = fileType.starts_with('.');
+            if ((isExtension && !(fileExtension.empty()) && fileExtension == fileType) ||
+                (!isExtension && (E.filename.find(fileType) != std::string_view::npos)))
+            {
+                selected = &syntax;
+                break;
+            }
+        }
+        if (selected)
+            break;
+    }
+
+    // renaming a file within the same language keeps the existing highlighting
+    if (E.filename.empty() || selected == E.syntax)
+        return;
+
+    E.syntax = selected;
+    E.redraw |= REDRAW_CONTENT | REDRAW_STATUS;
+
+    // everything is highlighted again by the worker, the old colours would be
+    // wrong until then
+    E.row.forEachLoaded([](erow& row) {
+        row.highlight.clear();
+        row.hlCheckpoints.reset();
+        row.hlEndState = HL_STATE_NORMAL;
+        row.hlValid = false;
+        editorRowChanged(row);
+    });
+    std::fill(E.sourceStates.begin(), E.sourceStates.end(), HL_STATE_UNKNOWN);
+    E.hlDirtyFrom = -1;
+    E.hlDirtyTo = -1;
+    E.hlPartialRow = -1;
+    editorInvalidateSyntax(0);
+}
+
+/* row operations */
+
+// a row whose text lives in the row arena
+erow editorNewRow(std::string_view line)
+{
+    return erow{std::pmr::string{line, E.arena.get()}};
+}
+
+// moves the loaded rows into a fresh arena once most of the old one is free,
+// called from a timer so it runs while the editor is idle
+void editorCompactRows()
+{
+    if (!E.arena->fragmented())
+        return;
+    // the search worker or a replace all may be reading the rows
+    if (E.searching || E.replacer)
+    {
+        editorSetTimer(KILO_COMPACT_DELAY_MS, editorCompactRows);
+        return;
+    }
+
+    auto arena = std::make_unique<RowArena>();
+    E.row.forEachLoaded([&](erow& row) {
+        std::pmr::string chars{row.chars, arena.get()};
+        // a pmr string keeps its allocator on assignment, so rebuild it
+        std::destroy_at(&row.chars);
+        std::construct_at(&row.chars, std::move(chars));
+    });
+    E.arena = std::move(arena);
+}
+
+// Positions in a row are counted three ways: bytes of chars, bytes of the
+// render and screen columns. Between glyphs a byte is a byte and a column, so
+// converting finds the last glyph before the position and counts on from
+// where it ends. A position inside a glyph maps to its start, except that
+// each of a tab's spaces is a column.
+int editorRowConvert(const erow& row, int pos, int Glyph::*from, int Glyph::*to)
+{
+    if (!row.glyphs)
+        return pos;
+
+    const GlyphMap& glyphs = *row.glyphs;
+    auto after = std::ranges::upper_bound(glyphs, pos, {}, from);
+    if (after == glyphs.begin())
+        return pos;
+    const Glyph& glyph = *std::prev(after);
+    int end = glyphEnd(glyph, from);
+    if (pos >= end)
+        return glyphEnd(glyph, to) + pos - end;
+    if (glyph.tab && from != &Glyph::cx && to != &Glyph::cx)
+        return glyph.*to + pos - glyph.*from;
+    return glyph.*to;
+}
+
+int editorRowCxToRx(const erow& row, int cursorX)
+{
+    cursorX = std::clamp(cursorX, 0, static_cast<int>(row.chars.size()));
+    return editorRowConvert(row, cursorX, &Glyph::cx, &Glyph::rx);
+}
+
+int editorRowRxToCx(const erow& row, int renderX)
+{
+    int cursorX = editorRowConvert(row, renderX, &Glyph::rx, &Glyph::cx);
+    return std::clamp(cursorX, 0, static_cast<int>(row.chars.size()));
+}
+
+int editorRowCxToColumn(const erow& row, int cursorX)
+{
+    cursorX = std::clamp(cursorX, 0, static_cast<int>(row.chars.size()));
+    return editorRowConvert(row, cursorX, &Glyph::cx, &Glyph::column);
+}
+
+int editorRowColumnToCx(const erow& row, int column)
+{
+    int cursorX = editorRowConvert(row, column, &Glyph::column, &Glyph::cx);
+    return std::clamp(cursorX, 0, static_cast<int>(row.chars.size()));
+}
+
+int editorRowRxToColumn(const erow& row, int renderX)
+{
+    return editorRowConvert(row, renderX, &Glyph::rx, &Glyph::column);
+}
+
+int editorRowColumnToRx(const erow& row, int column)
+{
+    return editorRowConvert(row, column, &Glyph::column, &Glyph::rx);
+}
+
+// the glyph starting at chars index cx, null when that's a plain character
+const Glyph* editorRowGlyphAt(const erow& row, int cx)
+{
+    if (!row.glyphs)
+        return nullptr;
+    auto glyph = std::ranges::lower_bound(*row.glyphs, cx, {}, &Glyph::cx);
+    return glyph != row.glyphs->end() && glyph->cx == cx ? &*glyph : nullptr;
+}
+
+// bytes of the character at cx
+int editorRowCharSize(const erow& row, int cx)
+{
+    const Glyph* glyph = editorRowGlyphAt(row, cx);
+    return glyph ? glyph->size : 1;
+}
+
+// where the character before cx starts
+int editorRowCharBefore(const erow& row, int cx)
+{
+    if (row.glyphs)
+    {
+        auto after = std::ranges::lower_bound(*row.glyphs, cx, {}, &Glyph::cx);
+        if (after != row.glyphs->begin() && glyphEnd(*std::prev(after), &Glyph::cx) == cx)
+            return std::prev(after)->cx;
+    }
+    return cx - 1;
+}
+
+// a combining mark at cx, which the cursor steps over with the character
+// before it
+bool editorRowMarkAt(const erow& row, int cx)
+{
+    const Glyph* glyph = editorRowGlyphAt(row, cx);
+    return glyph && !glyph->tab && glyph->width == 0;
+}
+
+// adds glyph to row's counts, or takes it off them when n is -1
+void editorCountGlyph(erow& row, const Glyph& glyph, int n)
+{
+    row.tabs += glyph.tab ? n : 0;
+    row.wide += !glyph.tab && glyph.width == 2 ? n : 0;
+}
+
+// the glyph for the character at cx of chars, a tab or a byte above 0x7f,
+// not placed yet
+Glyph editorDecodeGlyph(std::string_view chars, int cx)
+{
+    if (chars[cx] == '\t')
+        return Glyph{cx, 0, 0, 1, 0, true};
+
+    char32_t codepoint;
+    int size = utf8Decode(chars.substr(cx), codepoint);
+    return Glyph{cx, 0, 0, static_cast<std::uint8_t>(size), static_cast<std::uint8_t>(codepointWidth(codepoint)),
+                 false};
+}
+
+// sets where glyph i starts from where the one before it ends, and how wide
+// a tab is from the column it lands on
+void editorPlaceGlyph(GlyphMap& glyphs, std::size_t i)
+{
+    Glyph& glyph = glyphs[i];
+    int cx{0};
+    int rx{0};
+    int column{0};
+    if (i > 0)
+    {
+        cx = glyphEnd(glyphs[i - 1], &Glyph::cx);
+        rx = glyphEnd(glyphs[i - 1], &Glyph::rx);
+        column = glyphEnd(glyphs[i - 1], &Glyph::column);
+    }
+    glyph.rx = rx + glyph.cx - cx;
+    glyph.column = column + glyph.cx - cx;
+    if (glyph.tab)
+    {
+        glyph.width = tabStopEnd(glyph.column) - glyph.column;
+    }
+}
+
+// recomputes where the glyphs from i on start after the text before them
+// changed; once one lands where it was, the ones after it haven't moved.
+// Returns the render column the last tab it moved ends at, -1 if there were
+// none; the other glyphs only move.
+int editorRelayoutGlyphs(GlyphMap& glyphs, std::size_t i)
+{
+    int end{-1};
+    for (; i < glyphs.size(); ++i)
+    {
+        int rx = glyphs[i].rx;
+        int column = glyphs[i].column;
+        editorPlaceGlyph(glyphs, i);
+        if (glyphs[i].rx == rx && glyphs[i].column == column)
+            break;
+        if (glyphs[i].tab)
+        {
+            end = glyphEnd(glyphs[i], &Glyph::rx);
+        }
+    }
+    return end;
+}
+
+// true when text went in at at as one character that can't have changed
+// how the bytes around it decode; only stray bytes that aren't valid UTF-8
+// can, and then the row is decoded again whole
+bool editorRowCleanInsert(const erow& row, int at, std::string_view text)
+{
+    char32_t codepoint;
+    std::size_t after = at + text.size();
+    return !utf8Continuation(text[0]) && utf8Decode(text, codepoint) == static_cast<int>(text.size()) &&
+           (after == row.chars.size() || !utf8Continuation(row.chars[after]));
+}
+
+// Both keep the glyph map in step with the character ch inserted, or one of
+// size bytes deleted, at at, render column rx. They return the render column
+// the change to the render ends at, past which it only moved.
+
+int editorRowGlyphsInserted(erow& row, int at, int rx, std::string_view ch)
+{
+    bool plain = ch.size() == 1 && ch[0] != '\t' && !(ch[0] & 0x80);
+    if (!row.glyphs && plain)
+        return rx + 1;
+    if (!row.glyphs)
+    {
+        row.glyphs = std::make_unique<GlyphMap>();
+    }
+
+    GlyphMap& glyphs = *row.glyphs;
+    auto after = std::ranges::lower_bound(glyphs, at, {}, &Glyph::cx);
+    std::size_t i = after - glyphs.begin();
+    for (auto glyph = after; glyph != glyphs.end(); ++glyph)
+    {
+        glyph->cx += ch.size();
+    }
+    int end = rx + ch.size();
+    if (!plain)
+    {
+        glyphs.insert(after, editorDecodeGlyph(row.chars, at));
+        editorPlaceGlyph(glyphs, i);
+        editorCountGlyph(row, glyphs[i], 1);
+        end = glyphEnd(glyphs[i], &Glyph::rx);
+        ++i;
+    }
+    int moved = editorRelayoutGlyphs(glyphs, i);
+    return moved >= 0 ? moved : end;
+}
+
+int editorRowGlyphsDeleted(erow& row, int at, int rx, int size)
+{
+    if (!row.glyphs)
+        return rx;
+
+    GlyphMap& glyphs = *row.glyphs;
+    auto after = std::ranges::lower_bound(glyphs, at, {}, &Glyph::cx);
+    if (after != glyphs.end() && after->cx == at)
+    {
+        editorCountGlyph(row, *after, -1);
+        after = glyphs.erase(after);
+    }
+    if (glyphs.empty())
+    {
+        row.glyphs.reset();
+        return rx;
+    }
+    std::size_t i = after - glyphs.begin();
+    for (auto glyph = after; glyph != glyphs.end(); ++glyph)
+    {
+        glyph->cx -= size;
+    }
+    int moved = editorRelayoutGlyphs(glyphs, i);
+    return moved >= 0 ? moved : rx;
+}
+
+// render columns [from, to) of row, both on character boundaries
+std::string editorRowExpand(const erow& row, int from, int to)
+{
+    std::string text;
+    text.reserve(to - from);
+    for (int cx = editorRowRxToCx(row, from), rx = from; rx < to; ++cx)
+    {
+        if (row.chars[cx] == '\t')
+        {
+            int width = editorRowGlyphAt(row, cx)->width;
+            text.append(width, ' ');
+            rx += width;
+        }
+        else
+        {
+            text += row.chars[cx];
+            ++rx;
+        }
+    }
+    return text;
+}
+
+// render columns [from, oldEnd) of row were replaced with [from, newEnd) by
+// an edit; the render copy, if there is one, and the highlight are patched
+// rather than redone
+void editorRowEdited(erow& row, int from, int oldEnd, int newEnd)
+{
+    editorRowChanged(row);
+    if (!row.tabs)
+    {
+        row.render.clear();
+        row.render.shrink_to_fit();
+    }
+    else if (!row.render.empty())
+    {
+        row.render.replace(from, oldEnd - from, editorRowExpand(row, from, newEnd));
+    }
+
+    if (E.syntax && editorRowRender(row).size() >= KILO_LONG_ROW)
+    {
+        editorUpdateLongRowSyntax(row, from, oldEnd, newEnd);
+    }
+    else
+    {
+        editorUpdateSyntax(row);
+    }
+}
+
+// chars changed and tabs matches it again; the render copy is rebuilt when
+// next needed
+void editorInvalidateRender(erow& row)
+{
+    editorRowChanged(row);
+    row.render.clear();
+    if (!row.tabs)
+    {
+        row.render.shrink_to_fit();
+    }
+}
+
+void editorUpdateRender(erow& row)
+{
+    // most rows are plain ASCII without tabs and so never need a glyph map
+    // or render copy; the ASCII check and memchr are vectorised, only rows
+    // with other characters are decoded. Tabs are expanded when the row is
+    // first drawn or highlighted.
+    std::string_view chars = row.chars;
+    row.glyphs.reset();
+    row.tabs = 0;
+    row.wide = 0;
+    auto add = [&](const Glyph& glyph) {
+        if (!row.glyphs)
+        {
+            row.glyphs = std::make_unique<GlyphMap>();
+        }
+        row.glyphs->push_back(glyph);
+        editorPlaceGlyph(*row.glyphs, row.glyphs->size() - 1);
+        editorCountGlyph(row, glyph, 1);
+    };
+
+    if (isAscii(chars))
+    {
+        for (std::size_t pos{0}; const void* tab = std::memchr(chars.data() + pos, '\t', chars.size() - pos);)
+        {
+            int cx = static_cast<const char*>(tab) - chars.data();
+            add(Glyph{cx, 0, 0, 1, 0, true});
+            pos = cx + 1;
+        }
+    }
+    else
+    {
+        for (std::size_t cx{0}; cx < chars.size();)
+        {
+            unsigned char c = chars[cx];
+            if (c < 0x80 && c != '\t')
+            {
+                ++cx;
+                continue;
+            }
+            Glyph glyph = editorDecodeGlyph(chars, cx);
+            add(glyph);
+            cx += glyph.size;
+        }
+    }
+    editorInvalidateRender(row);
+}
+
+void editorUpdateRow(erow& row)
+{
+    editorUpdateRender(row);
+    editorUpdateSyntax(row);
+}
+
+// text of row at without loading it when it still lives in the mapped file
+std::string_view editorRowText(int at)
+{
+    std::size_t sourceLine;
+    if (const erow* row = E.row.peek(at, sourceLine))
+        return row->chars;
+    return E.lines.line(E.file.view(), sourceLine);
+}
+
+void editorInsertRow(int at, std::string_view line)
+{
+    if (at < 0 || at > E.numrows)
+        return;
+
+    // E.hlPartialRow would no longer name the right row
+    editorFinishPartialSyntax();
+    erow row = editorNewRow(line);
+    row.hlStartState = editorRowEndState(at - 1);
+    editorUpdateRow(E.row.insert(at, std::move(row)));
+    editorUpdateWrap(at);
+    E.numrows++;
+    E.dirty++;
+    E.redraw |= REDRAW_CONTENT;
+    editorInvalidateSyntax(at);
+    editorUpdateSyntaxFrom(at);
+}
+
+// inserts ch, the bytes of one character, at at
+void editorRowInsertChar(erow& row, int at, std::string_view ch)
+{
+    int length = row.chars.size();
+    if (at < 0 || at > length)
+    {
+        at = length;
+    }
+    int rx = editorRowCxToRx(row, at);
+    int oldSize = editorRowCxToRx(row, length);
+    row.chars.insert(at, ch);
+    E.dirty++;
+    E.redraw |= REDRAW_CONTENT;
+    if (!editorRowCleanInsert(row, at, ch))
+    {
+        editorUpdateRow(row);
+        return;
+    }
+
+    int end = editorRowGlyphsInserted(row, at, rx, ch);
+    int newSize = editorRowCxToRx(row, row.chars.size());
+    editorRowEdited(row, rx, end - (newSize - oldSize), end);
+}
+
+// deletes the character starting at at
+void editorRowDeleteChar(erow& row, int at)
+{
+    int length = row.chars.size();
+    if (at < 0 || at >= length)
+    {
+        return;
+    }
+
+    int rx = editorRowCxToRx(row, at);
+    int oldSize = editorRowCxToRx(row, length);
+    int size = editorRowCharSize(row, at);
+    row.chars.erase(at, size);
+    E.dirty++;
+    E.redraw |= REDRAW_CONTENT;
+    if (at < static_cast<int>(row.chars.size()) && utf8Continuation(row.chars[at]))
+    {
+        // stray bytes on either side now decode together
+        editorUpdateRow(row);
+        return;
+    }
+
+    int end = editorRowGlyphsDeleted(row, at, rx, size);
+    int newSize = editorRowCxToRx(row, row.chars.size());
+    editorRowEdited(row, rx, end - (newSize - oldSize), end);
+}
+
+void editorRowAppendString(erow& row, std::string_view str)
+{
+    row.chars.append(str);
+    editorUpdateRow(row);
+    E.dirty++;
+    E.redraw |= REDRAW_CONTENT;
+}
+
+void editorDelRow(erow& row, int at)
+{
+    if (at < 0 || at >= E.numrows)
+        return;
+
+    editorFinishPartialSyntax();
+    E.row.erase(at);
+    E.numrows--;
+    if (E.arena->fragmented())
+    {
+        editorSetTimer(KILO_COMPACT_DELAY_MS, editorCompactRows);
+    }
+    E.dirty++;
+    E.redraw |= REDRAW_CONTENT;
+    editorInvalidateSyntax(at);
+    editorUpdateSyntaxFrom(at);
+}
+
+/* soft wrap */
+
+// columns text takes once its tabs are expanded
+int editorTextWidth(std::string_view text)
+{
+    int width{0};
+    std::size_t pos{0};
+    if (isAscii(text))
+    {
+        while (const void* tab = std::memchr(text.data() + pos, '\t', text.size() - pos))
+        {
+            std::size_t at = static_cast<const char*>(tab) - text.data();
+            width = tabStopEnd(width + (at - pos));
+            pos = at + 1;
+        }
+        return width + (text.size() - pos);
+    }
+
+    while (pos < text.size())
+    {
+        if (text[pos] == '\t')
+        {
+            width = tabStopEnd(width);
+            ++pos;
+            continue;
+        }
+        char32_t codepoint;
+        pos += utf8Decode(text.substr(pos), codepoint);
+        width += codepointWidth(codepoint);
+    }
+    return width;
+}
+
+// Rows are wrapped every E.screencols columns, except that a double width
+// character that would straddle the end of a screen line starts the next one
+// instead.
+
+int editorWrapHeight(int width, int cols)
+{
+    return std::max(1, (width + cols - 1) / cols);
+}
+
+// screen lines text takes wrapped at cols, counted the way editorRowHeight()
+// counts a row; reads nothing from E, so the wrap indexer can call it
+int editorTextHeight(std::string_view text, int cols)
+{
+    if (isAscii(text))
+        return editorWrapHeight(editorTextWidth(text), cols);
+
+    int lines{1};
+    int lineStart{0};
+    int column{0};
+    for (std::size_t pos{0}; pos < text.size();)
+    {
+        int width;
+        bool tab = text[pos] == '\t';
+        if (tab)
+        {
+            width = tabStopEnd(column) - column;
+            ++pos;
+        }
+        else
+        {
+            char32_t codepoint;
+            pos += utf8Decode(text.substr(pos), codepoint);
+            width = codepointWidth(codepoint);
+        }
+
+        while (column + width > lineStart + cols)
+        {
+            bool straddles = !tab && width == 2 && column == lineStart + cols - 1 && cols > 1;
+            lineStart = straddles ? column : lineStart + cols;
+            ++lines;
+        }
+        column += width;
+    }
+    return lines;
+}
+
+// column the screen line after the one starting at column start starts at
+int editorRowNextLine(const erow& row, int start)
+{
+    int end = start + E.screencols;
+    if (!row.wide)
+        return end;
+    int column = editorRowRxToColumn(row, editorRowColumnToRx(row, end));
+    return column > start && column < end ? column : end;
+}
+
+// screen lines row takes
+int editorRowHeight(const erow& row)
+{
+    if (!E.wrap)
+        return 1;
+    int width = editorRowCxToColumn(row, row.chars.size());
+    if (!row.wide)
+        return editorWrapHeight(width, E.screencols);
+
+    int lines{1};
+    for (int start = editorRowNextLine(row, 0); start < width; start = editorRowNextLine(row, start))
+    {
+        ++lines;
+    }
+    return lines;
+}
+
+// column screen line sub of row starts at
+int editorRowLineStart(const erow& row, int sub)
+{
+    if (!row.wide)
+        return sub * E.screencols;
+
+    int start{0};
+    while (sub-- > 0)
+    {
+        start = editorRowNextLine(row, start);
+    }
+    return start;
+}
+
+// screen line of row that column is on, with the column that line starts at;
+// the end of a row that exactly fills its last line stays on it
+int editorRowLineOf(const erow& row, int column, int& start)
+{
+    int width = editorRowCxToColumn(row, row.chars.size());
+    if (!row.wide)
+    {
+        int sub = std::min(column, std::max(width - 1, 0)) / E.screencols;
+        start = sub * E.screencols;
+        return sub;
+    }
+
+    int sub{0};
+    start = 0;
+    for (int next = editorRowNextLine(row, 0); next <= column && next < width; next = editorRowNextLine(row, next))
+    {
+        start = next;
+        ++sub;
+    }
+    return sub;
+}
+
+// screen line row at starts on
+int editorRowVisualLine(int at)
+{
+    return E.wrap ? E.row.weightBefore(at) : at;
+}
+
+// row screen line line falls on, and which of the row's screen lines it is;
+// E.numrows or past it for lines below the last row
+int editorVisualLineRow(int line, int& sub)
+{
+    if (!E.wrap)
+    {
+        sub = 0;
+        return line;
+    }
+    std::size_t offset;
+    int at = E.row.findWeight(line, offset);
+    sub = offset;
+    return at;
+}
+
+// rows with at least one line on screen, top up to bottom
+void editorVisibleRows(int& top, int& bottom)
+{
+    int sub;
+    top = std::min(editorVisualLineRow(E.rowoffset, sub), E.numrows);
+    bottom = std::min(editorVisualLineRow(E.rowoffset + E.screenrows - 1, sub) + 1, E.numrows);
+}
+
+// screen line of the cursor, and its column within that line
+int editorCursorVisualLine(int& column)
+{
+    int renderX = E.cursorY < E.numrows ? editorRowCxToColumn(E.row[E.cursorY], E.cursorX) : 0;
+    if (!E.wrap)
+    {
+        column = renderX;
+        return E.cursorY;
+    }
+
+    int sub{0};
+    int start{0};
+    if (E.cursorY < E.numrows)
+    {
+        sub = editorRowLineOf(E.row[E.cursorY], renderX, start);
+    }
+    column = renderX - start;
+    return editorRowVisualLine(E.cursorY) + sub;
+}
+
+// moves the cursor to column of screen line line, as near as the text there
+// allows
+void editorMoveToVisualLine(int line, int column)
+{
+    int sub;
+    int at = editorVisualLineRow(line, sub);
+    if (at >= E.numrows)
+    {
+        E.cursorY = E.numrows;
+        E.cursorX = 0;
+        return;
+    }
+
+    const erow& row = E.row[at];
+    int start = editorRowLineStart(row, sub);
+    int cursorX = editorRowColumnToCx(row, start + std::min(column, E.screencols - 1));
+    // a tab or wide character reaching in from the line above belongs to it
+    if (editorRowCxToColumn(row, cursorX) < start)
+    {
+        cursorX += editorRowCharSize(row, cursorX);
+    }
+    E.cursorY = at;
+    E.cursorX = cursorX;
+}
+
+// row at changed length, recounts its screen lines
+void editorUpdateWrap(int at)
+{
+    if (E.wrap)
+    {
+        E.row.reweigh(at);
+    }
+}
+
+// weighs rows by the screen lines they take, unloaded ones through
+// E.wrapSource or as one each until it's built
+void editorWeighRows()
+{
+    E.row.setWeights([](const erow& row) { return editorRowHeight(row); },
+                     [](std::size_t line) { return E.wrapSource.empty() ? line : E.wrapSource[line]; });
+}
+
+// turns soft wrap on or off, or wraps again at a new screen width, keeping
+// the row at the top of the screen there
+void editorSetWrap(bool wrap)
+{
+    int sub;
+    int top = editorVisualLineRow(E.rowoffset, sub);
+
+    E.wrap = wrap;
+    E.wrapIndexer.reset();
+    E.wrapSource.clear();
+    if (wrap)
+    {
+        // the file's lines are measured in the background, rows only when
+        // they are loaded or change
+        if (E.lines.size())
+        {
+            int cols = E.screencols;
+            E.wrapIndexer = std::make_unique<WrapIndexer>(
+                E.file.view(), E.lines, [cols](std::string_view line) { return editorTextHeight(line, cols); },
+                [] { editorWakeup(WAKEUP_WRAP); });
+        }
+        editorWeighRows();
+    }
+    else
+    {
+        E.wrapSource.shrink_to_fit();
+        E.row.setWeights({}, {});
+    }
+
+    E.coloffset = 0;
+    E.rowoffset = editorRowVisualLine(std::min(top, E.numrows));
+    E.drawCache.clear();
+    E.redraw = REDRAW_ALL;
 }
 
-void editorDelRow(erow& row, int at)
+// weighs the unloaded rows by their screen lines once the wrap indexer has
+// measured them, keeping the row at the top of the screen there
+void editorCollectWrap()
 {
-    if (at < 0 || at >= E.numrows)
+    if (!E.wrapIndexer)
         return;
-
-    E.row.erase(E.row.begin() + at);
-    E.numrows--;
-    E.dirty++;
+    std::optional<std::vector<std::uint32_t>> source = E.wrapIndexer->take();
+    if (!source)
+        return;
+    E.wrapIndexer.reset();
+
+    int sub;
+    int top = editorVisualLineRow(E.rowoffset, sub);
+    E.wrapSource = std::move(*source);
+    editorWeighRows();
+    E.rowoffset = editorRowVisualLine(std::min(top, E.numrows)) + sub;
+    E.drawCache.clear();
+    E.redraw = REDRAW_ALL;
+    editorRefreshScreen();
 }
 
 /* editor operations */
 
-void editorInsertChar(int c)
+// inserts ch, the bytes of one character, at the cursor
+void editorInsertChar(std::string_view ch)
 {
     if (E.cursorY == E.numrows)
     {
         editorInsertRow(E.numrows, "");
     }
 
-    editorRowInsertChar(E.row[E.cursorY], E.cursorX, c);
-    E.cursorX++;
+    editorRowInsertChar(E.row[E.cursorY], E.cursorX, ch);
+    editorUpdateWrap(E.cursorY);
+    editorUpdateSyntaxFrom(E.cursorY);
+    E.cursorX += ch.size();
 }
 
 void editorDelChar()
@@ -560,13 +2029,17 @@ void editorDelChar()
 
     if (E.cursorX > 0)
     {
-        editorRowDeleteChar(E.row[E.cursorY], E.cursorX - 1);
-        E.cursorX--;
+        int at = editorRowCharBefore(E.row[E.cursorY], E.cursorX);
+        editorRowDeleteChar(E.row[E.cursorY], at);
+        editorUpdateWrap(E.cursorY);
+        editorUpdateSyntaxFrom(E.cursorY);
+        E.cursorX = at;
     }
     else
     {
         int prevLen = E.row[E.cursorY - 1].chars.length();
         editorRowAppendString(E.row[E.cursorY - 1], E.row[E.cursorY].chars);
+        editorUpdateWrap(E.cursorY - 1);
         editorDelRow(E.row[E.cursorY], E.cursorY);
         E.cursorY--;
         E.cursorX = prevLen;
@@ -582,23 +2055,93 @@ void editorInsertNewline()
     else
     {
         erow& row = E.row[E.cursorY];
-        editorInsertRow(E.cursorY + 1, row.chars.substr(E.cursorX));
+        editorInsertRow(E.cursorY + 1, std::string_view{row.chars}.substr(E.cursorX));
         row.chars.erase(E.cursorX);
         editorUpdateRow(row);
+        editorUpdateWrap(E.cursorY);
+        editorUpdateSyntaxFrom(E.cursorY);
     }
     E.cursorY++;
     E.cursorX = 0;
 }
 
+// inserts text at the cursor, "\r", "\n" and "\r\n" starting new lines; each
+// touched row is rebuilt and highlighted once however long the text is
+void editorInsertText(std::string_view text)
+{
+    if (text.empty())
+        return;
+
+    if (E.cursorY == E.numrows)
+    {
+        editorInsertRow(E.numrows, "");
+    }
+
+    int firstY = E.cursorY;
+    erow& first = E.row[E.cursorY];
+    std::string tail{std::string_view{first.chars}.substr(E.cursorX)};
+    first.chars.erase(E.cursorX);
+
+    std::size_t lineEnd = text.find_first_of("\r\n");
+    first.chars.append(text.substr(0, lineEnd));
+    if (lineEnd == std::string_view::npos)
+    {
+        E.cursorX = first.chars.size();
+        first.chars.append(tail);
+    }
+    editorUpdateRow(first);
+    editorUpdateWrap(firstY);
+
+    while (lineEnd != std::string_view::npos)
+    {
+        std::size_t next = lineEnd + 1;
+        if (text[lineEnd] == '\r' && next < text.size() && text[next] == '\n')
+        {
+            ++next;
+        }
+        lineEnd = text.find_first_of("\r\n", next);
+
+        std::string line{text.substr(next, lineEnd == std::string_view::npos ? lineEnd : lineEnd - next)};
+        E.cursorY++;
+        if (lineEnd == std::string_view::npos)
+        {
+            // the last line carries what followed the cursor
+            E.cursorX = line.size();
+            line += tail;
+        }
+        editorInsertRow(E.cursorY, line);
+    }
+    editorUpdateSyntaxFrom(firstY);
+
+    E.dirty++;
+    E.redraw |= REDRAW_CONTENT;
+}
+
 /* file i/o */
+// calls f(line) for every row in order, reading rows that were never loaded
+// straight from the mapped file
+template <typename F> void editorForEachLine(F&& f)
+{
+    E.row.forEachSpan([&](const erow* row, std::size_t first, std::size_t count) {
+        if (row)
+        {
+            f(std::string_view{row->chars});
+            return;
+        }
+        for (std::size_t i{first}; i < first + count; ++i)
+        {
+            f(E.lines.line(E.file.view(), i));
+        }
+    });
+}
+
 std::string editorRowsToString()
 {
     std::string fileContent;
-    for (const erow row : E.row)
-    {
-        fileContent += row.chars;
+    editorForEachLine([&](std::string_view line) {
+        fileContent += line;
         fileContent += '\n';
-    }
+    });
     return fileContent;
 }
 
@@ -608,31 +2151,88 @@ void editorOpen(char* filename)
 
     editorSelectSyntaxHighlight();
 
-    std::ifstream infile;
-    infile.open(filename);
-    if (!infile.is_open())
+    if (!E.file.open(E.filename))
     {
         die("fs.open");
     }
 
-    for (std::string line; std::getline(infile, line);)
-    {
-        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+    // only the line offsets are built up front, rows are created from the
+    // mapping the first time they are viewed or edited
+    E.lines = LineIndex::build(E.file.view());
+    E.row.assignSource(E.lines.size(), [](std::size_t line) {
+        // drawn plain until the worker has highlighted it
+        erow row = editorNewRow(E.lines.line(E.file.view(), line));
+        editorUpdateRender(row);
+        if (E.sourceStates[line] != HL_STATE_UNKNOWN)
         {
-            line.pop_back();
+            row.hlStartState = E.sourceStates[line];
         }
+        return row;
+    });
+    E.numrows = E.lines.size();
+    E.dirty = 0;
+    E.sourceStates.assign(E.lines.size(), HL_STATE_UNKNOWN);
+    editorInvalidateSyntax(0);
+    if (E.wrap)
+    {
+        editorSetWrap(true);
+    }
 
-        editorInsertRow(E.numrows, line);
+    if (E.file.view().size() >= KILO_TRIGRAM_MIN_BYTES)
+    {
+        E.indexer = std::make_unique<TrigramIndexer>(E.file.view(), E.lines, [] { editorWakeup(WAKEUP_INDEX); });
     }
-    infile.close();
-    E.dirty = 0;
+}
+
+// writes the rows to path, replacing what it held; the bytes written, or
+// nullopt with errno set
+std::optional<std::size_t> editorWriteFile(const std::string& path)
+{
+    std::ofstream ostream(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!ostream)
+        return std::nullopt;
+
+    std::size_t written{0};
+    editorForEachLine([&](std::string_view line) {
+        ostream.write(line.data(), line.size());
+        ostream.put('\n');
+        written += line.size() + 1;
+    });
+    ostream.close();
+    if (!ostream)
+        return std::nullopt;
+    return written;
+}
+
+// loads every row still in the mapped file and unmaps it, so the file can be
+// written in place
+void editorDetachFile()
+{
+    for (int at{0}; at < E.numrows; ++at)
+    {
+        E.row[at];
+    }
+
+    // the workers may still be reading rows from the mapping
+    E.indexer.reset();
+    E.wrapIndexer.reset();
+    E.trigrams.reset();
+    E.highlighter = std::make_unique<HighlightWorker>([] { editorWakeup(WAKEUP_HIGHLIGHT); });
+    E.hlGeneration++;
+    E.hlUrgentBusy = false;
+    E.hlBackgroundBusy = false;
+
+    E.file.close();
+    E.lines = {};
+    E.sourceStates.clear();
+    E.wrapSource.clear();
 }
 
 void editorSave()
 {
     if (E.filename.empty())
     {
-        E.filename = editorPrompt("Save as: %s", nullptr);
+        E.filename = editorPrompt("Save as: %s", nullptr).value_or("");
         if (E.filename.empty())
         {
             editorSetStatusMessage("Save aborted");
@@ -641,110 +2241,398 @@ void editorSave()
         editorSelectSyntaxHighlight();
     }
 
-    std::string fileContent = editorRowsToString();
+    // a symlink is saved through to the file it points to
+    std::string path = E.filename;
+    if (char* real = realpath(E.filename.c_str(), nullptr))
+    {
+        path = real;
+        free(real);
+    }
 
-    std::ofstream ostream(E.filename, std::ios::out);
+    struct stat st;
+    bool exists = stat(path.c_str(), &st) == 0;
+    // renaming over a file with other links would leave them on the old text
+    bool inPlace = exists && st.st_nlink > 1;
+    std::optional<std::size_t> written;
+    if (!inPlace)
+    {
+        // unloaded rows still point into the mapping of the file being
+        // replaced, so write a sibling file and rename it over the original:
+        // the old inode stays alive for as long as it is mapped
+        std::string tmpFilename = path + ".kilo~";
+        written = editorWriteFile(tmpFilename);
+        if (written && exists &&
+            (chown(tmpFilename.c_str(), st.st_uid, st.st_gid) == -1 || chmod(tmpFilename.c_str(), st.st_mode) == -1))
+        {
+            // the sibling can't have the original's owner, the file is
+            // written itself instead
+            inPlace = true;
+        }
+        else if (written && std::rename(tmpFilename.c_str(), path.c_str()) == 0)
+        {
+            editorSetStatusMessage("%zu bytes written to disk", *written);
+            E.dirty = 0;
+            return;
+        }
+        int savedErrno = errno;
+        std::remove(tmpFilename.c_str());
+        errno = savedErrno;
+    }
 
-    if (ostream)
+    if (inPlace)
     {
-        if (ostream.write(fileContent.c_str(), fileContent.length()))
+        editorDetachFile();
+        written = editorWriteFile(path);
+        if (written)
         {
-            editorSetStatusMessage("%d bytes written to disk", fileContent.length());
+            editorSetStatusMessage("%zu bytes written to disk", *written);
             E.dirty = 0;
             return;
         }
-        ostream.close();
     }
 
     editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
 }
 
 /* find */
-void editorFindCallback(std::string_view query, int key)
+// the buffer as spans for the search worker; rows that were never loaded are
+// searched in the mapped file a run at a time
+std::vector<SearchSpan> editorSearchSpans()
+{
+    std::vector<SearchSpan> spans;
+    int at{0};
+    E.row.forEachSpan([&](const erow* row, std::size_t first, std::size_t count) {
+        if (row)
+            spans.push_back({at, 1, row->chars, nullptr, 0});
+        else
+            spans.push_back({at, static_cast<int>(count), E.file.view(), &E.lines, first});
+        at += count;
+    });
+    return spans;
+}
+
+// where the query of E.matches is found in row at, whose text is text, the
+// way the search worker counts it; kept until the matches change, so a row
+// is only matched again once they do
+const std::vector<RegexMatch>& editorMatchesIn(int at, std::string_view text)
+{
+    if (E.rowMatchesOf != E.matches)
+    {
+        E.rowMatchesOf = E.matches;
+        E.rowMatches.clear();
+    }
+    auto [cached, added] = E.rowMatches.try_emplace(at);
+    std::vector<RegexMatch>& found = cached->second;
+    if (!added)
+        return found;
+
+    if (E.matches->regex)
+    {
+        found = E.regex->matches(text);
+        return found;
+    }
+    std::string_view query = E.matches->query;
+    for (std::size_t start = text.find(query); start != std::string_view::npos;
+         start = text.find(query, start + query.size()))
+    {
+        found.push_back({start, start + query.size()});
+    }
+    return found;
+}
+
+// moves the cursor to match index of E.matches and makes it the current one
+void editorSelectMatch(std::size_t index)
+{
+    const SearchResult& matches = *E.matches;
+    std::size_t i = std::ranges::upper_bound(matches.counts, index) - matches.counts.begin();
+    std::size_t before = i ? matches.counts[i - 1] : 0;
+    int current = matches.rows[i];
+    erow& row = E.row[current];
+    RegexMatch match = editorMatchesIn(current, row.chars)[index - before];
+
+    E.cursorY = current;
+    E.cursorX = match.start;
+    E.rowoffset = editorRowVisualLine(E.numrows);
+
+    E.matchIndex = index;
+    E.matchRow = current;
+    E.matchStart = editorRowCxToRx(row, match.start);
+    E.matchEnd = editorRowCxToRx(row, match.end);
+    E.redraw |= REDRAW_CONTENT | REDRAW_STATUS;
+}
+
+// called when the search worker finishes
+void editorCollectSearch()
 {
-    static int lastMatch = -1;
-    static int direction = 1;
+    std::shared_ptr<const SearchResult> result = E.searcher->takeFinished();
+    // the worker is already on the query that replaced an older one
+    if (!result || result->query != E.searchQuery || result->regex != E.searchRegex)
+        return;
 
-    static int savedHighlightLine;
-    static std::string savedHighlight = {""};
+    E.matches = std::move(result);
+    if (E.matches->total())
+        editorSelectMatch(0);
+    E.redraw |= REDRAW_CONTENT | REDRAW_STATUS;
+    editorRefreshScreen();
+}
 
-    if (!savedHighlight.empty())
+// called when the trigram index is built
+void editorCollectTrigrams()
+{
+    E.trigrams = E.indexer->take();
+    E.indexer.reset();
+    // the prompt's message stays while it's open
+    if (!E.searching)
     {
-        E.row[savedHighlightLine].highlight = savedHighlight;
-        savedHighlight.clear();
+        editorSetStatusMessage("Search index ready: %zu trigrams, %zu MiB", E.trigrams->trigrams(),
+                               E.trigrams->memoryUsage() >> 20);
+        editorRefreshScreen();
     }
+}
 
+void editorFindCallback(std::string_view query, int key)
+{
     if (key == '\r' || key == '\x1b')
     {
-        lastMatch = -1;
-        direction = 1;
+        // enter takes the first match even if it's still being looked for
+        if (key == '\r' && !query.empty() && !E.matches)
+        {
+            E.matches = E.searcher->wait();
+            if (E.matches && E.matches->query == query && E.matches->regex == E.searchRegex && E.matches->total())
+                editorSelectMatch(0);
+        }
+        E.searchQuery.clear();
+        E.matches.reset();
+        E.rowMatchesOf.reset();
+        E.rowMatches.clear();
+        E.matchRow = -1;
+        E.regex.reset();
+        E.regexError.clear();
+        E.redraw |= REDRAW_CONTENT | REDRAW_STATUS;
+        return;
+    }
+
+    if (key == ARROW_RIGHT || key == ARROW_DOWN || key == ARROW_LEFT || key == ARROW_UP)
+    {
+        // nothing to step through until the matches are counted
+        if (!E.matches || E.matchRow < 0)
+            return;
+        std::size_t total = E.matches->total();
+        bool forward = key == ARROW_RIGHT || key == ARROW_DOWN;
+        editorSelectMatch((E.matchIndex + (forward ? 1 : total - 1)) % total);
         return;
     }
-    else if (key == ARROW_RIGHT || key == ARROW_DOWN)
+
+    if (key == CTRL_KEY('r'))
     {
-        direction = 1;
+        // the same query searched the other way
+        E.searchRegex = !E.searchRegex;
+        E.searchQuery.clear();
+        E.redraw |= REDRAW_STATUS;
     }
-    else if (key == ARROW_LEFT || key == ARROW_UP)
+
+    if (query == E.searchQuery)
+        return;
+
+    // typing goes on while the worker counts the new query's matches
+    E.searchQuery = query;
+    E.matches.reset();
+    E.matchRow = -1;
+    E.regex.reset();
+    E.regexError.clear();
+    if (!query.empty() && !E.searchRegex)
     {
-        direction = -1;
+        E.searcher->submit(E.searchQuery);
     }
-    else
+    else if (!query.empty())
+    {
+        // a half typed pattern is often invalid, it's searched once it isn't
+        if (std::shared_ptr<const Regex> regex = Regex::compile(query, E.regexError))
+        {
+            E.regex = std::make_unique<RegexMatcher>(regex);
+            E.searcher->submit(std::move(regex));
+        }
+    }
+    E.redraw |= REDRAW_CONTENT | REDRAW_STATUS;
+}
+
+void editorFind()
+{
+    int prevCX = E.cursorX;
+    int prevCY = E.cursorY;
+    int prevColOff = E.coloffset;
+    int prevRowOff = E.rowoffset;
+    // Ctrl-R switches to a regex for this prompt only
+    bool prevRegex = E.searchRegex;
+
+    // the buffer can't change while the prompt is open
+    E.searcher->reset(editorSearchSpans(), E.trigrams.get());
+    E.searching = true;
+    std::optional<std::string> query = editorPrompt("Search: %s (Ctrl-R = regex | ESC to cancel)", editorFindCallback);
+    E.searching = false;
+    E.searcher->reset({});
+    E.searchRegex = prevRegex;
+
+    // restore cursor position and offset
+    if (!query)
     {
-        lastMatch = -1;
-        direction = 1;
+        E.cursorX = prevCX;
+        E.cursorY = prevCY;
+        E.coloffset = prevColOff;
+        E.rowoffset = prevRowOff;
     }
+}
 
-    if (lastMatch == -1)
+// takes the rows a replace all changed once it's done, or shows how far it
+// got; called when it signals the event loop
+void editorCollectReplace()
+{
+    if (!E.replacer)
+        return;
+
+    E.replaced = E.replacer->take();
+    if (!E.replaced)
     {
-        direction = 1;
+        editorSetStatusMessage("Replacing... %d%% (ESC to cancel)",
+                               static_cast<int>(100LL * E.replacer->rowsDone() / std::max(E.numrows, 1)));
+        editorRefreshScreen();
     }
-    int current{lastMatch};
-    for (int i{0}; i < E.numrows; ++i)
+}
+
+// true when ESC is among the keys read so far, which are dropped up to it
+bool editorTakeEscape()
+{
+    std::string_view pending{E.input};
+    pending.remove_prefix(E.inputPos);
+    std::size_t used{0};
+    while (used < pending.size())
     {
-        current += direction;
-        if (current == -1)
+        int key;
+        std::size_t length = editorDecodeKey(pending.substr(used), key);
+        // the terminal sends a sequence whole, an escape left at the end is
+        // the key
+        if (!length && pending.substr(used) != "\x1b")
+            return false;
+        used += std::max<std::size_t>(length, 1);
+        if (key == '\x1b')
         {
-            current = E.numrows - 1;
+            editorConsumeInput(used);
+            return true;
         }
-        else if (current == E.numrows)
+    }
+    return false;
+}
+
+// replaces every match of query, a regex when E.searchRegex is set, with
+// replacement. The rows are found and rebuilt across threads in the
+// background, then the changed ones are swapped in as one edit and left to the
+// highlight worker
+void editorReplaceAll(std::string_view query, std::string_view replacement)
+{
+    std::shared_ptr<const Regex> regex;
+    if (E.searchRegex)
+    {
+        std::string error;
+        regex = Regex::compile(query, error);
+        if (!regex)
         {
-            current = 0;
+            editorSetStatusMessage("Invalid regex: %s", error.c_str());
+            return;
         }
+    }
 
-        erow& row = E.row[current];
-        std::size_t match = row.render.find(query);
-        if (!(match == std::string::npos))
+    editorSetStatusMessage("Replacing... (ESC to cancel)");
+    editorRefreshScreen();
+    E.replacer = std::make_unique<Replacer>(editorSearchSpans(), E.trigrams.get(), std::string{query}, regex,
+                                            std::string{replacement}, [] { editorWakeup(WAKEUP_REPLACE); });
+    // the rows mustn't change under it, keys typed meanwhile wait their turn
+    // but ESC, which stops it and leaves the rows as they were
+    while (!E.replaced)
+    {
+        if (!editorWaitForInput(-1, [] { return E.replaced.has_value(); }))
+            continue;
+        editorReadInput();
+        if (editorTakeEscape())
         {
-            lastMatch = current;
-            E.cursorY = current;
-            E.cursorX = editorRowRxToCx(row, match);
-            E.rowoffset = E.numrows;
+            E.replacer.reset();
+            E.replaced.reset();
+            editorSetStatusMessage("Replace cancelled");
+            return;
+        }
+    }
+    E.replacer.reset();
+    Replacement replaced = std::move(*E.replaced);
+    E.replaced.reset();
 
-            savedHighlightLine = current;
-            savedHighlight = row.highlight;
-            std::fill_n(row.highlight.begin() + match, query.length(), HL_MATCH);
-            break;
+    for (std::size_t i{0}; i < replaced.rows.size(); ++i)
+    {
+        int at = replaced.rows[i];
+        erow& row = E.row[at];
+        row.chars = std::move(replaced.texts[i]);
+        editorUpdateRender(row);
+        editorUpdateWrap(at);
+        // highlighted again by the worker, once for all the rows below the
+        // first; the old colours would be wrong until then
+        row.highlight.clear();
+        row.hlCheckpoints.reset();
+        row.hlEndState = HL_STATE_NORMAL;
+        row.hlValid = false;
+        editorRowChanged(row);
+    }
+
+    if (!replaced.rows.empty())
+    {
+        editorInvalidateSyntax(replaced.rows.front());
+        E.dirty++;
+        E.redraw |= REDRAW_CONTENT;
+    }
+    if (E.cursorY < E.numrows)
+    {
+        // the text before the cursor may have changed length, it lands on the
+        // start of whichever character it now falls in
+        const erow& row = E.row[E.cursorY];
+        E.cursorX = std::min<int>(E.cursorX, row.chars.size());
+        while (E.cursorX > 0 && E.cursorX < static_cast<int>(row.chars.size()) &&
+               utf8Continuation(row.chars[E.cursorX]))
+        {
+            --E.cursorX;
         }
     }
+    editorSetStatusMessage("Replaced %zu occurrences in %zu lines", replaced.count, replaced.rows.size());
 }
 
-void editorFind()
+void editorReplace()
 {
     int prevCX = E.cursorX;
     int prevCY = E.cursorY;
     int prevColOff = E.coloffset;
     int prevRowOff = E.rowoffset;
+    bool prevRegex = E.searchRegex;
 
-    std::string query = editorPrompt("Search: %s (ESC to cancel)", editorFindCallback);
+    // the query is typed with the matches highlighted, as in editorFind
+    E.searcher->reset(editorSearchSpans(), E.trigrams.get());
+    E.searching = true;
+    std::optional<std::string> query = editorPrompt("Replace: %s (Ctrl-R = regex | ESC to cancel)", editorFindCallback);
+    E.searching = false;
+    E.searcher->reset({});
 
-    // restore cursor position and offset
-    if (query.empty())
+    std::optional<std::string> replacement;
+    if (query)
+    {
+        replacement = editorPrompt("Replace with: %s (ESC to cancel)", nullptr, true);
+    }
+    if (!replacement)
     {
         E.cursorX = prevCX;
         E.cursorY = prevCY;
         E.coloffset = prevColOff;
         E.rowoffset = prevRowOff;
     }
+    else
+    {
+        editorReplaceAll(*query, *replacement);
+    }
+    E.searchRegex = prevRegex;
 }
 
 /* output */
@@ -754,32 +2642,41 @@ void editorScroll()
 
     if (E.cursorY < E.numrows)
     {
-        E.renderX = editorRowCxToRx(E.row[E.cursorY], E.cursorX);
+        E.renderX = editorRowCxToColumn(E.row[E.cursorY], E.cursorX);
     }
-    if (E.cursorY < E.rowoffset)
+    E.visualY = editorCursorVisualLine(E.visualX);
+    if (E.visualY < E.rowoffset)
     {
-        E.rowoffset = E.cursorY;
+        E.rowoffset = E.visualY;
     }
-    if (E.cursorY >= E.rowoffset + E.screenrows)
+    if (E.visualY >= E.rowoffset + E.screenrows)
     {
-        E.rowoffset = E.cursorY - E.screenrows + 1;
+        E.rowoffset = E.visualY - E.screenrows + 1;
     }
 
+    // wrapped rows never scroll sideways
+    if (E.wrap)
+        return;
     if (E.renderX < E.coloffset)
     {
         E.coloffset = E.renderX;
     }
     if (E.renderX >= E.coloffset + E.screencols)
     {
-        E.coloffset = E.renderX - E.coloffset + 1;
+        E.coloffset = E.renderX - E.screencols + 1;
     }
 }
 
-void editorDrawRows(std::string& buffer)
+void editorDrawRows()
 {
+    E.drawCache.resize(E.screenrows);
+    // the row on the first screen line and which of its screen lines that is
+    int sub;
+    int filerow = editorVisualLineRow(E.rowoffset, sub);
     for (int y{0}; y < E.screenrows; ++y)
     {
-        int filerow = y + E.rowoffset;
+        E.screen.clearRow(y);
+
         if (filerow >= E.numrows)
         {
             if (E.numrows == 0 && y == E.screenrows / 3)
@@ -789,136 +2686,217 @@ void editorDrawRows(std::string& buffer)
                 int padding = (E.screencols - welcomeLength) / 2;
                 if (padding)
                 {
-                    buffer.append(1, '~');
-                    --padding;
-                }
-                while (padding--)
-                {
-                    buffer.append(1, ' ');
+                    E.screen.put(y, 0, "~");
                 }
 
-                buffer.append(welcome.c_str(), welcomeLength);
+                E.screen.put(y, padding, std::string_view{welcome}.substr(0, welcomeLength));
             }
             else
             {
-                buffer.append(1, '~');
+                E.screen.put(y, 0, "~");
             }
         }
         else
         {
-            int len = E.row[filerow].render.size() - E.coloffset;
-            if (len < 0)
+            erow& row = E.row[filerow];
+            // column is where the screen line starts, from and to the part
+            // of the render that fits on it
+            int column = E.coloffset + (sub ? editorRowLineStart(row, sub) : 0);
+            int from = editorRowColumnToRx(row, column);
+            // a wide character cut by the left edge is left blank
+            int lead = editorRowRxToColumn(row, from) < column;
+            if (lead)
             {
-                len = 0;
+                from = editorRowColumnToRx(row, column + 1);
             }
-
-            if (len > E.screencols)
+            int to = editorRowColumnToRx(row, column + E.screencols);
+            if (row.hlEndState == HL_STATE_UNKNOWN)
             {
-                len = E.screencols;
+                editorExtendRowSyntax(row, to);
             }
 
-            char* c = E.row[filerow].render.data() + E.coloffset;
-            char* hl = E.row[filerow].highlight.data() + E.coloffset;
+            std::string_view render = editorRowRender(row);
+            from = std::min(from, static_cast<int>(render.size()));
+            to = std::min(to, static_cast<int>(render.size()));
+            std::string_view c = render.substr(from, to - from);
 
-            int currentColour{-1};
-            for (int j{0}; j < len; ++j)
+            // rows that didn't change since they were last composed are copied
+            DrawCache& cache = E.drawCache[y];
+            if (cache.row == &row && cache.stamp == row.stamp && cache.coloffset == column)
+            {
+                E.screen.putRow(y, cache.cells);
+            }
+            else
             {
-                if (hl[j] == HL_NORMAL)
+                // one put per highlight run in view and one per plain gap
+                // between them, each starting where the one before ended
+                auto run = std::partition_point(row.highlight.begin(), row.highlight.end(),
+                                                [&](const HighlightRun& r) {
+                                                    return static_cast<int>(r.start + r.length) <= from;
+                                                });
+                int x = from;
+                int screenX = lead;
+                for (; run != row.highlight.end() && static_cast<int>(run->start) < to; ++run)
                 {
-                    if (currentColour != -1)
-                    {
-                        buffer.append("\x1b[39m", 5);
-                        currentColour = -1;
-                    }
-                    buffer.append(1, c[j]);
+                    int start = std::max<int>(run->start, from);
+                    int end = std::min<int>(run->start + run->length, to);
+                    screenX = E.screen.put(y, screenX, c.substr(x - from, start - x));
+                    screenX = E.screen.put(y, screenX, c.substr(start - from, end - start),
+                                           Attr{static_cast<std::uint8_t>(editorSyntaxToColor(run->hl))});
+                    x = end;
                 }
-                else
+                E.screen.put(y, screenX, c.substr(x - from));
+
+                std::span<const Cell> cells = E.screen.row(y);
+                cache.row = &row;
+                cache.stamp = row.stamp;
+                cache.coloffset = column;
+                cache.cells.assign(cells.begin(), cells.end());
+            }
+
+            if (E.matches && std::ranges::binary_search(E.matches->rows, filerow))
+            {
+                // matches are drawn over the cells, the current one inverted
+                for (RegexMatch match : editorMatchesIn(filerow, row.chars))
                 {
-                    int colour = editorSyntaxToColor(hl[j]);
-                    if (colour != currentColour)
+                    int start = editorRowCxToRx(row, match.start);
+                    if (start >= to)
+                        break;
+                    bool current = filerow == E.matchRow && start == E.matchStart;
+                    int end = std::min(editorRowCxToRx(row, match.end), to);
+                    start = std::max(start, from);
+                    if (start < end)
                     {
-                        currentColour = colour;
-                        std::string colourByte = std::format("\x1b[{}m", colour);
-                        buffer.append(colourByte);
+                        E.screen.put(y, editorRowRxToColumn(row, start) - column, c.substr(start - from, end - start),
+                                     Attr{static_cast<std::uint8_t>(editorSyntaxToColor(HL_MATCH)),
+                                          static_cast<std::uint8_t>(current ? ATTR_INVERSE : 0)});
                     }
-                    buffer.append(1, c[j]);
                 }
             }
-            // reset colour back to white
-            buffer.append("\x1b[39m", 5);
-        }
 
-        buffer.append("\x1b[K", 3);
-        buffer.append("\r\n", 2);
+            if (++sub < editorRowHeight(row))
+                continue;
+        }
+        filerow++;
+        sub = 0;
     }
 }
 
-void editorDrawStatusBar(std::string& buffer)
+void editorDrawStatusBar()
 {
-    buffer.append("\x1b[7m", 4);
+    int y = E.screenrows;
+    E.screen.clearRow(y);
 
     std::string status = std::format("{:20s} - {:d} lines {:s}", E.filename.empty() ? "[No Name]" : E.filename,
                                      E.numrows, E.dirty ? "(modified)" : "");
-    std::size_t len{status.length() > E.screencols ? E.screencols : status.length()};
+    int len = editorTextWidth(status);
 
     std::string rStatus =
         std::format("{:s} | {:d}/{:d}", E.syntax ? E.syntax->filetype : "no ft", E.cursorY + 1, E.numrows);
-
-    buffer.append(status.c_str(), len);
-
-    while (len < E.screencols)
+    if (!E.searchQuery.empty())
     {
-        if (E.screencols - len == rStatus.length())
-        {
-            buffer.append(rStatus.c_str(), rStatus.length());
-            break;
-        }
-        else
-        {
-            buffer.append(" ");
-            ++len;
-        }
+        std::string count = !E.regexError.empty() ? E.regexError
+                            : !E.matches          ? "searching"
+                            : E.matches->total()  ? std::format("{:d} of {:d}", E.matchIndex + 1, E.matches->total())
+                                                  : "no matches";
+        rStatus = count + " | " + rStatus;
+    }
+    if (E.searching && E.searchRegex)
+    {
+        rStatus = "regex | " + rStatus;
     }
 
-    buffer.append("\x1b[m", 3);
-    buffer.append("\r\n", 2);
+    // the whole bar is drawn inverted, padding included; put() clips the
+    // file name, which can have characters of any width, to the screen
+    Attr inverse{0, ATTR_INVERSE};
+    E.screen.put(y, 0, std::string(E.screencols, ' '), inverse);
+    E.screen.put(y, 0, status, inverse);
+    if (len + static_cast<int>(rStatus.length()) <= E.screencols)
+    {
+        E.screen.put(y, E.screencols - rStatus.length(), rStatus, inverse);
+    }
 }
 
-void editorDrawMessageBar(std::string& buffer)
+void editorDrawMessageBar()
 {
-    buffer.append("\x1b[K", 3);
-    int msgLen{static_cast<int>(E.statusmsg.length())};
-    if (msgLen > E.screencols)
-        msgLen = E.screencols;
+    int y = E.screenrows + 1;
+    E.screen.clearRow(y);
 
-    if (msgLen && std::time(nullptr) - E.statusmsg_time < 5)
+    // put() clips the message to the screen
+    if (!E.statusmsg.empty() && std::time(nullptr) - E.statusmsg_time < KILO_STATUS_MESSAGE_SECONDS)
     {
-
-        buffer.append(E.statusmsg.c_str(), msgLen);
+        E.screen.put(y, 0, E.statusmsg);
     }
 }
 
 void editorRefreshScreen()
 {
+    // state the current frame was drawn from
+    static int drawnRowoffset{0};
+    static int drawnColoffset{0};
+    static int drawnCursorY{-1};
+    static int drawnRenderX{-1};
+    static bool drawnMessage{false};
+
     editorScroll();
 
-    std::string buffer;
+    if (E.rowoffset != drawnRowoffset || E.coloffset != drawnColoffset)
+    {
+        E.redraw |= REDRAW_VIEWPORT;
+    }
+    if (E.cursorY != drawnCursorY || E.renderX != drawnRenderX)
+    {
+        E.redraw |= REDRAW_CURSOR;
+    }
+    bool showMessage = !E.statusmsg.empty() && std::time(nullptr) - E.statusmsg_time < KILO_STATUS_MESSAGE_SECONDS;
+    if (showMessage != drawnMessage)
+    {
+        E.redraw |= REDRAW_STATUS;
+    }
+
+    if (!E.redraw)
+        return;
+
+    // let the terminal move rows that are still visible after a vertical
+    // scroll, only the newly exposed ones get drawn
+    if (E.rowoffset != drawnRowoffset)
+    {
+        int lines = E.rowoffset - drawnRowoffset;
+        E.screen.scroll(0, E.screenrows - 1, lines);
 
-    // hide cursor
-    buffer.append("\x1b[?25l", 6);
-    buffer.append("\x1b[H", 3);
+        // keep the cached rows next to where they are drawn now
+        if (std::abs(lines) < static_cast<int>(E.drawCache.size()))
+        {
+            auto middle = lines > 0 ? E.drawCache.begin() + lines : E.drawCache.end() + lines;
+            std::rotate(E.drawCache.begin(), middle, E.drawCache.end());
+        }
+    }
 
-    editorDrawRows(buffer);
-    editorDrawStatusBar(buffer);
-    editorDrawMessageBar(buffer);
+    // compose only what the keypress invalidated; a pure cursor move leaves
+    // the text area alone and only the status bar's line number changes
+    if (E.redraw & (REDRAW_CONTENT | REDRAW_VIEWPORT))
+    {
+        editorDrawRows();
+        // rows that just came into view are highlighted before anything else
+        editorQueueHighlight();
+    }
+    editorDrawStatusBar();
+    editorDrawMessageBar();
 
-    std::string cursor = std::format("\x1b[{};{}H", (E.cursorY - E.rowoffset) + 1, (E.renderX - E.coloffset) + 1);
-    buffer.append(cursor.c_str(), cursor.size());
+    std::string buffer;
+    E.screen.flush(buffer, E.visualY - E.rowoffset, std::min(E.visualX - E.coloffset, E.screencols - 1));
 
-    // display cursor
-    buffer.append("\x1b[?25h", 6);
+    if (!buffer.empty())
+    {
+        write(STDOUT_FILENO, buffer.c_str(), buffer.size());
+    }
 
-    write(STDOUT_FILENO, buffer.c_str(), buffer.size());
+    E.redraw = 0;
+    drawnRowoffset = E.rowoffset;
+    drawnColoffset = E.coloffset;
+    drawnCursorY = E.cursorY;
+    drawnRenderX = E.renderX;
+    drawnMessage = showMessage;
 }
 
 // // For info on variadic templates, see
@@ -941,11 +2919,30 @@ void editorSetStatusMessage(std::string_view fmt, ...)
 
     E.statusmsg = buf;
     E.statusmsg_time = std::time(nullptr);
+    E.redraw |= REDRAW_STATUS;
+
+    // clear the message off the screen when it expires, even if no key is hit
+    editorSetTimer(KILO_STATUS_MESSAGE_SECONDS * 1000, editorRefreshScreen);
 }
 
 /* input */
 
-std::string editorPrompt(std::string&& prompt, void (*callback)(std::string_view, int))
+// the character whose first byte is c, with the rest of its UTF-8 sequence
+// when that has already been read
+std::string editorReadChar(int c)
+{
+    std::string ch(1, static_cast<char>(c));
+    for (int left = utf8Length(c) - 1; left > 0 && editorKeyPending() && utf8Continuation(E.input[E.inputPos]); --left)
+    {
+        ch += static_cast<char>(editorReadKey());
+    }
+    return ch;
+}
+
+// what was typed, nullopt when cancelled; enter needs some text unless
+// allowEmpty is set
+std::optional<std::string> editorPrompt(std::string&& prompt, void (*callback)(std::string_view, int),
+                                        bool allowEmpty)
 {
     std::string buf;
     while (true)
@@ -956,6 +2953,11 @@ std::string editorPrompt(std::string&& prompt, void (*callback)(std::string_view
         int c = editorReadKey();
         if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE)
         {
+            // the whole of the last character
+            while (!buf.empty() && utf8Continuation(buf.back()))
+            {
+                buf.pop_back();
+            }
             if (!buf.empty())
             {
                 buf.pop_back();
@@ -968,12 +2970,12 @@ std::string editorPrompt(std::string&& prompt, void (*callback)(std::string_view
             {
                 callback(buf, c);
             }
-            return "";
+            return std::nullopt;
         }
         // if enter key
         else if (c == '\r')
         {
-            if (!buf.empty())
+            if (!buf.empty() || allowEmpty)
             {
 
                 editorSetStatusMessage("");
@@ -984,9 +2986,19 @@ std::string editorPrompt(std::string&& prompt, void (*callback)(std::string_view
                 return buf;
             }
         }
-        else if (!iscntrl(c) && c < 128)
+        else if (c == PASTE)
+        {
+            // only the first line of a paste makes sense in a prompt
+            for (char ch : E.paste.substr(0, E.paste.find_first_of("\r\n")))
+            {
+                if (!iscntrl(static_cast<unsigned char>(ch)))
+                    buf += ch;
+            }
+            E.paste.clear();
+        }
+        else if (!iscntrl(c) && c < 256)
         {
-            buf += c;
+            buf += editorReadChar(c);
         }
 
         if (callback)
@@ -1003,7 +3015,11 @@ void editorMoveCursor(int key)
     case ARROW_LEFT:
         if (E.cursorX != 0)
         {
-            E.cursorX--;
+            const erow& row = E.row[E.cursorY];
+            do
+            {
+                E.cursorX = editorRowCharBefore(row, E.cursorX);
+            } while (E.cursorX > 0 && editorRowMarkAt(row, E.cursorX));
         }
         else if (E.cursorY > 0)
         { // if cursorX == 0 and not first line move to previous line
@@ -1012,24 +3028,38 @@ void editorMoveCursor(int key)
         }
         break;
     case ARROW_RIGHT:
-        if (E.cursorY < E.numrows && E.cursorX < E.row[E.cursorY].chars.size())
+        if (E.cursorY < E.numrows && E.cursorX < static_cast<int>(E.row[E.cursorY].chars.size()))
         {
-            E.cursorX++;
+            // combining marks go with the character before them
+            const erow& row = E.row[E.cursorY];
+            do
+            {
+                E.cursorX += editorRowCharSize(row, E.cursorX);
+            } while (E.cursorX < static_cast<int>(row.chars.size()) && editorRowMarkAt(row, E.cursorX));
         }
-        else if (E.cursorY < E.numrows && E.cursorX == E.row[E.cursorY].chars.size())
+        else if (E.cursorY < E.numrows && E.cursorX == static_cast<int>(E.row[E.cursorY].chars.size()))
         {
             E.cursorY++;
             E.cursorX = 0;
         }
         break;
     case ARROW_UP:
-        if (E.cursorY > 0)
+    case ARROW_DOWN:
+        if (E.wrap)
+        {
+            // a screen line at a time through wrapped rows
+            int column;
+            int line = editorCursorVisualLine(column) + (key == ARROW_UP ? -1 : 1);
+            if (line >= 0 && line <= editorRowVisualLine(E.numrows))
+            {
+                editorMoveToVisualLine(line, column);
+            }
+        }
+        else if (key == ARROW_UP && E.cursorY > 0)
         {
             E.cursorY--;
         }
-        break;
-    case ARROW_DOWN:
-        if (E.cursorY < E.numrows)
+        else if (key == ARROW_DOWN && E.cursorY < E.numrows)
         {
             E.cursorY++;
         }
@@ -1038,11 +3068,9 @@ void editorMoveCursor(int key)
 
     if (E.cursorY < E.numrows)
     {
-        int rowLen = E.row[E.cursorY].chars.size();
-        if (E.cursorX > rowLen)
-        {
-            E.cursorX = rowLen;
-        }
+        // past the end of a shorter row, or into the middle of a character
+        const erow& row = E.row[E.cursorY];
+        E.cursorX = editorRowColumnToCx(row, editorRowCxToColumn(row, E.cursorX));
     }
 }
 
@@ -1082,7 +3110,7 @@ void editorProcessKeypress()
     case END_KEY:
         if (E.cursorY < E.numrows)
         {
-            E.cursorY = E.row[E.cursorY].chars.size();
+            E.cursorX = E.row[E.cursorY].chars.size();
         }
         break;
 
@@ -1090,6 +3118,10 @@ void editorProcessKeypress()
         editorFind();
         break;
 
+    case CTRL_KEY('r'):
+        editorReplace();
+        break;
+
     case BACKSPACE:
     case CTRL_KEY('h'):
     case DEL_KEY:
@@ -1098,16 +3130,23 @@ void editorProcessKeypress()
 
     case PAGE_UP:
     case PAGE_DOWN: {
-        if (c == PAGE_UP)
+        if (!E.wrap && c == PAGE_UP)
         {
             E.cursorY = E.rowoffset;
         }
-        else if (c == PAGE_DOWN)
+        else if (!E.wrap && c == PAGE_DOWN)
         {
             E.cursorY = E.rowoffset + E.screenrows - 1;
             if (E.cursorY > E.numrows)
                 E.cursorY = E.numrows;
         }
+        else
+        {
+            int column;
+            editorCursorVisualLine(column);
+            int bottom = std::min(E.rowoffset + E.screenrows - 1, editorRowVisualLine(E.numrows));
+            editorMoveToVisualLine(c == PAGE_UP ? E.rowoffset : bottom, column);
+        }
 
         int times = E.screenrows;
         while (times--)
@@ -1123,14 +3162,39 @@ void editorProcessKeypress()
         editorMoveCursor(c);
         break;
 
+    case CTRL_KEY('w'):
+        editorSetWrap(!E.wrap);
+        editorSetStatusMessage(E.wrap ? "Soft wrap on" : "Soft wrap off");
+        break;
+
     case CTRL_KEY('l'):
     case '\x1b':
         break;
 
-    default:
-        editorInsertChar(c);
+    case PASTE:
+        editorInsertText(E.paste);
+        E.paste.clear();
+        break;
+
+    default: {
+        std::string text = editorReadChar(c);
+        if (editorTextPending() && c >= 32 && c != 127)
+        {
+            // a burst of typed text (or a paste without bracketed paste
+            // support) goes in with a single row update
+            while (editorTextPending())
+            {
+                text += static_cast<char>(editorReadKey());
+            }
+            editorInsertText(text);
+        }
+        else
+        {
+            editorInsertChar(text);
+        }
         break;
     }
+    }
 
     // reset quit_times if other key pressed
     quit_times = KILO_QUIT_TIMES;
@@ -1141,19 +3205,44 @@ void initEditor()
     E.cursorX = 0;
     E.cursorY = 0;
     E.renderX = 0;
+    E.visualY = 0;
+    E.visualX = 0;
     E.rowoffset = 0;
     E.coloffset = 0;
     E.numrows = 0;
-    E.row = {};
+    E.row.clear();
+    E.arena = std::make_unique<RowArena>();
     E.dirty = 0;
     E.filename = "";
     E.statusmsg = "";
     E.statusmsg_time = 0;
+    E.redraw = REDRAW_ALL;
+    E.searching = false;
+    E.searchRegex = false;
+    E.matchRow = -1;
+    E.drawCache.clear();
+    E.rowStamp = 0;
     E.syntax = nullptr;
+    E.input.clear();
+    E.inputPos = 0;
+    E.paste.clear();
+    E.hlGeneration = 0;
+    E.hlDirtyFrom = -1;
+    E.hlDirtyState = -1;
+    E.hlDirtyTo = -1;
+    E.hlUrgentBusy = false;
+    E.hlBackgroundBusy = false;
+    E.hlPartialRow = -1;
+    E.sourceStates.clear();
+    E.wrap = false;
+    E.wrapSource.clear();
 
     if (getWindowSize(E.screenrows, E.screencols) == -1)
         die("getWindowSize");
 
+    // the screen also holds the status and message bars
+    E.screen.resize(E.screenrows, E.screencols);
+
     // reserve a line at the bottom for our status bar
     E.screenrows -= 2;
 }
@@ -1162,17 +3251,23 @@ int main(int argc, char* argv[])
 {
     enableRawMode();
     initEditor();
+    initEventLoop();
     if (argc >= 2)
     {
         editorOpen(argv[1]);
     }
 
-    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find | Ctrl-R = replace | Ctrl-W = wrap");
 
     while (1)
     {
         editorRefreshScreen();
-        editorProcessKeypress();
+
+        // handle every key that arrived together before drawing again
+        do
+        {
+            editorProcessKeypress();
+        } while (editorKeyPending());
     }
     return 0;
 }
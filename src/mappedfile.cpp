@@ -0,0 +1,52 @@
+#include "mappedfile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    // mmap rejects zero-length mappings, an empty file is just an empty view
+    if (st.st_size > 0)
+    {
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            ::close(fd);
+            return false;
+        }
+        m_data = static_cast<const char*>(data);
+        m_size = st.st_size;
+    }
+
+    // the mapping keeps the file alive, the descriptor is no longer needed
+    ::close(fd);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_data)
+        munmap(const_cast<char*>(m_data), m_size);
+    m_data = nullptr;
+    m_size = 0;
+}
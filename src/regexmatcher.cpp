@@ -0,0 +1,1033 @@
+#include "regexmatcher.h"
+
+#include <algorithm>
+#include <cctype>
+#include <utility>
+
+namespace
+{
+
+// instructions a pattern can compile to, each way
+constexpr std::size_t MAX_INSTS{1u << 16};
+// bounds of a counted repeat
+constexpr int MAX_REPEAT{1000};
+// DFA states kept before the cache is dropped and built up again
+constexpr std::size_t MAX_STATES{4096};
+// stands in for the instructions of an unanchored DFA's state at the start of
+// a line, where a match starting with ^ can begin
+constexpr int LINE_START{-1};
+// stands in for the instructions of a reach state past the end of a line,
+// where a match ending with $ can end
+constexpr int LINE_END{-2};
+
+using ByteSet = std::bitset<256>;
+
+struct Node
+{
+    enum class Kind
+    {
+        Empty,
+        Bytes,
+        Concat,
+        Alternate,
+        Repeat,
+        LineStart,
+        LineEnd,
+    };
+
+    Kind kind{Kind::Empty};
+    ByteSet bytes;
+    std::vector<Node> children;
+    // for Repeat, max -1 for no bound
+    int min{0};
+    int max{0};
+};
+
+struct ParseError
+{
+    const char* message;
+};
+
+Node bytesNode(ByteSet bytes)
+{
+    Node node{Node::Kind::Bytes};
+    node.bytes = bytes;
+    return node;
+}
+
+Node byteNode(unsigned char byte)
+{
+    ByteSet bytes;
+    bytes.set(byte);
+    return bytesNode(bytes);
+}
+
+Node byteRange(unsigned char first, unsigned char last)
+{
+    ByteSet bytes;
+    for (unsigned byte{first}; byte <= last; ++byte)
+    {
+        bytes.set(byte);
+    }
+    return bytesNode(bytes);
+}
+
+Node sequence(std::vector<Node> children)
+{
+    if (children.size() == 1)
+        return std::move(children[0]);
+    Node node{Node::Kind::Concat};
+    node.children = std::move(children);
+    return node;
+}
+
+Node literal(std::string_view text)
+{
+    std::vector<Node> bytes;
+    for (char c : text)
+    {
+        bytes.push_back(byteNode(c));
+    }
+    return sequence(std::move(bytes));
+}
+
+// any multibyte UTF-8 character; invalid sequences are left unmatched
+Node anyMultibyte()
+{
+    Node node{Node::Kind::Alternate};
+    node.children.push_back(sequence({byteRange(0xc2, 0xdf), byteRange(0x80, 0xbf)}));
+    node.children.push_back(sequence({byteRange(0xe0, 0xef), byteRange(0x80, 0xbf), byteRange(0x80, 0xbf)}));
+    node.children.push_back(
+        sequence({byteRange(0xf0, 0xf4), byteRange(0x80, 0xbf), byteRange(0x80, 0xbf), byteRange(0x80, 0xbf)}));
+    return node;
+}
+
+ByteSet asciiBytes()
+{
+    ByteSet bytes;
+    for (unsigned byte{0}; byte < 0x80; ++byte)
+    {
+        bytes.set(byte);
+    }
+    return bytes;
+}
+
+// A character class as the ASCII characters in it, whether every non-ASCII
+// character is, and the non-ASCII characters listed in it.
+struct CharClass
+{
+    ByteSet ascii;
+    bool nonAscii{false};
+    std::vector<std::string> chars;
+
+    void negate()
+    {
+        if (!chars.empty())
+            throw ParseError{"non-ASCII character in negated class"};
+        ascii = ~ascii & asciiBytes();
+        ascii.reset('\n');
+        nonAscii = !nonAscii;
+    }
+
+    Node node() const
+    {
+        Node node{Node::Kind::Alternate};
+        if (ascii.any() || (!nonAscii && chars.empty()))
+            node.children.push_back(bytesNode(ascii));
+        if (nonAscii)
+            node.children.push_back(anyMultibyte());
+        for (const std::string& c : chars)
+        {
+            node.children.push_back(literal(c));
+        }
+        if (node.children.size() == 1)
+            return std::move(node.children[0]);
+        return node;
+    }
+};
+
+// the class of \d, \w and \s, negated for their capitals; false for other
+// letters
+bool escapeClass(char c, CharClass& out)
+{
+    CharClass escaped;
+    switch (std::tolower(static_cast<unsigned char>(c)))
+    {
+    case 'd':
+        for (char digit{'0'}; digit <= '9'; ++digit)
+        {
+            escaped.ascii.set(digit);
+        }
+        break;
+    case 'w':
+        for (unsigned byte{0}; byte < 0x80; ++byte)
+        {
+            if (std::isalnum(byte) || byte == '_')
+                escaped.ascii.set(byte);
+        }
+        break;
+    case 's':
+        for (char space : {' ', '\t', '\n', '\r', '\f', '\v'})
+        {
+            escaped.ascii.set(space);
+        }
+        break;
+    default:
+        return false;
+    }
+    if (std::isupper(static_cast<unsigned char>(c)))
+        escaped.negate();
+
+    out.ascii |= escaped.ascii;
+    out.nonAscii |= escaped.nonAscii;
+    return true;
+}
+
+// Recursive descent over the pattern's bytes. Throws ParseError.
+class Parser
+{
+  public:
+    explicit Parser(std::string_view pattern) : m_pattern{pattern}
+    {
+    }
+
+    Node parse()
+    {
+        Node node = alternation();
+        if (m_at < m_pattern.size())
+            throw ParseError{"unmatched )"};
+        return node;
+    }
+
+  private:
+    bool done() const
+    {
+        return m_at >= m_pattern.size();
+    }
+
+    char peek() const
+    {
+        return m_pattern[m_at];
+    }
+
+    Node alternation()
+    {
+        Node node{Node::Kind::Alternate};
+        node.children.push_back(concatenation());
+        while (!done() && peek() == '|')
+        {
+            ++m_at;
+            node.children.push_back(concatenation());
+        }
+        if (node.children.size() == 1)
+            return std::move(node.children[0]);
+        return node;
+    }
+
+    Node concatenation()
+    {
+        std::vector<Node> children;
+        while (!done() && peek() != '|' && peek() != ')')
+        {
+            children.push_back(repetition());
+        }
+        if (children.empty())
+            return Node{};
+        return sequence(std::move(children));
+    }
+
+    Node repetition()
+    {
+        if (peek() == '*' || peek() == '+' || peek() == '?' || peek() == '{')
+            throw ParseError{"nothing to repeat"};
+
+        Node node = atom();
+        while (!done())
+        {
+            int min;
+            int max;
+            char c = peek();
+            if (c == '*')
+                min = 0, max = -1;
+            else if (c == '+')
+                min = 1, max = -1;
+            else if (c == '?')
+                min = 0, max = 1;
+            else if (c == '{')
+                counted(min, max);
+            else
+                break;
+            if (c != '{')
+                ++m_at;
+            // lazy quantifiers are accepted, but every match is the longest
+            if (!done() && peek() == '?')
+                ++m_at;
+
+            Node repeat{Node::Kind::Repeat};
+            repeat.children.push_back(std::move(node));
+            repeat.min = min;
+            repeat.max = max;
+            node = std::move(repeat);
+        }
+        return node;
+    }
+
+    // {n}, {n,} or {n,m}
+    void counted(int& min, int& max)
+    {
+        ++m_at;
+        min = number();
+        max = min;
+        if (!done() && peek() == ',')
+        {
+            ++m_at;
+            max = !done() && std::isdigit(static_cast<unsigned char>(peek())) ? number() : -1;
+        }
+        if (done() || peek() != '}')
+            throw ParseError{"missing }"};
+        ++m_at;
+        if (max >= 0 && max < min)
+            throw ParseError{"bad repeat"};
+    }
+
+    int number()
+    {
+        if (done() || !std::isdigit(static_cast<unsigned char>(peek())))
+            throw ParseError{"bad repeat"};
+        int value{0};
+        while (!done() && std::isdigit(static_cast<unsigned char>(peek())))
+        {
+            value = value * 10 + (m_pattern[m_at++] - '0');
+            if (value > MAX_REPEAT)
+                throw ParseError{"repeat too large"};
+        }
+        return value;
+    }
+
+    Node atom()
+    {
+        char c = m_pattern[m_at++];
+        switch (c)
+        {
+        case '(': {
+            if (!done() && peek() == '?')
+            {
+                if (m_pattern.substr(m_at, 2) != "?:")
+                    throw ParseError{"unsupported group"};
+                m_at += 2;
+            }
+            Node node = alternation();
+            if (done())
+                throw ParseError{"missing )"};
+            ++m_at;
+            return node;
+        }
+        case '[':
+            return charClass();
+        case '.': {
+            CharClass any;
+            any.negate();
+            return any.node();
+        }
+        case '^':
+            return Node{Node::Kind::LineStart};
+        case '$':
+            return Node{Node::Kind::LineEnd};
+        case '\\': {
+            if (done())
+                throw ParseError{"trailing \\"};
+            CharClass escaped;
+            if (escapeClass(peek(), escaped))
+            {
+                ++m_at;
+                return escaped.node();
+            }
+            return byteNode(escapedByte());
+        }
+        default:
+            // a multibyte character repeats as a whole
+            --m_at;
+            return literal(character());
+        }
+    }
+
+    // the byte an escape other than a class stands for, after the backslash
+    char escapedByte()
+    {
+        char c = m_pattern[m_at++];
+        switch (c)
+        {
+        case 't':
+            return '\t';
+        case 'n':
+            return '\n';
+        case 'r':
+            return '\r';
+        case 'f':
+            return '\f';
+        case 'v':
+            return '\v';
+        }
+        if (std::isalnum(static_cast<unsigned char>(c)) || static_cast<unsigned char>(c) >= 0x80)
+            throw ParseError{"unsupported escape"};
+        return c;
+    }
+
+    // the UTF-8 character at the current byte, as its bytes
+    std::string_view character()
+    {
+        std::size_t start = m_at++;
+        while (!done() && (static_cast<unsigned char>(peek()) & 0xc0) == 0x80)
+        {
+            ++m_at;
+        }
+        return m_pattern.substr(start, m_at - start);
+    }
+
+    Node charClass()
+    {
+        CharClass result;
+        bool negated = !done() && peek() == '^';
+        if (negated)
+            ++m_at;
+
+        // a ] right after the [ is taken literally
+        for (bool first{true}; first || done() || peek() != ']'; first = false)
+        {
+            if (done())
+                throw ParseError{"missing ]"};
+
+            std::string_view c;
+            char escaped;
+            if (peek() == '\\')
+            {
+                ++m_at;
+                if (done())
+                    throw ParseError{"missing ]"};
+                if (escapeClass(peek(), result))
+                {
+                    ++m_at;
+                    continue;
+                }
+                escaped = escapedByte();
+                c = std::string_view{&escaped, 1};
+            }
+            else
+            {
+                c = character();
+            }
+
+            bool range = m_at + 1 < m_pattern.size() && peek() == '-' && m_pattern[m_at + 1] != ']';
+            if (c.size() > 1)
+            {
+                if (range)
+                    throw ParseError{"non-ASCII range"};
+                result.chars.emplace_back(c);
+                continue;
+            }
+            unsigned char low = c[0];
+            unsigned char high = low;
+            if (range)
+            {
+                ++m_at;
+                if (peek() == '\\')
+                {
+                    ++m_at;
+                    if (done())
+                        throw ParseError{"missing ]"};
+                    high = escapedByte();
+                }
+                else
+                {
+                    std::string_view last = character();
+                    if (last.size() > 1)
+                        throw ParseError{"non-ASCII range"};
+                    high = last[0];
+                }
+                if (high < low)
+                    throw ParseError{"bad range"};
+            }
+            for (unsigned byte{low}; byte <= high; ++byte)
+            {
+                result.ascii.set(byte);
+            }
+        }
+        ++m_at;
+
+        if (negated)
+            result.negate();
+        return result.node();
+    }
+
+    std::string_view m_pattern;
+    std::size_t m_at{0};
+};
+
+// Compiles nodes back to front, each to instructions that go on to next once
+// it has matched.
+class Emitter
+{
+  public:
+    Emitter(Regex::Program& program, std::vector<ByteSet>& sets) : m_program{program}, m_sets{sets}
+    {
+    }
+
+    void emit(const Node& root)
+    {
+        int match = add({Regex::Op::Match});
+        m_program.start = emit(root, match);
+    }
+
+  private:
+    int add(Regex::Inst inst)
+    {
+        if (m_program.insts.size() >= MAX_INSTS)
+            throw ParseError{"pattern too large"};
+        m_program.insts.push_back(inst);
+        return m_program.insts.size() - 1;
+    }
+
+    int set(const ByteSet& bytes)
+    {
+        auto found = std::ranges::find(m_sets, bytes);
+        if (found != m_sets.end())
+            return found - m_sets.begin();
+        m_sets.push_back(bytes);
+        return m_sets.size() - 1;
+    }
+
+    int emit(const Node& node, int next)
+    {
+        switch (node.kind)
+        {
+        case Node::Kind::Empty:
+            return next;
+        case Node::Kind::Bytes:
+            return add({Regex::Op::Byte, next, -1, set(node.bytes)});
+        case Node::Kind::LineStart:
+            return add({Regex::Op::AssertStart, next});
+        case Node::Kind::LineEnd:
+            return add({Regex::Op::AssertEnd, next});
+        case Node::Kind::Concat:
+            for (auto child = node.children.rbegin(); child != node.children.rend(); ++child)
+            {
+                next = emit(*child, next);
+            }
+            return next;
+        case Node::Kind::Alternate: {
+            int entry = emit(node.children.back(), next);
+            for (std::size_t i = node.children.size() - 1; i-- > 0;)
+            {
+                int branch = emit(node.children[i], next);
+                entry = add({Regex::Op::Split, branch, entry});
+            }
+            return entry;
+        }
+        case Node::Kind::Repeat: {
+            const Node& child = node.children[0];
+            int entry = next;
+            if (node.max < 0)
+            {
+                entry = add({Regex::Op::Split, -1, next});
+                int body = emit(child, entry);
+                m_program.insts[entry].out = body;
+            }
+            else
+            {
+                // each optional copy can stop before the next one
+                for (int i{node.min}; i < node.max; ++i)
+                {
+                    int body = emit(child, entry);
+                    entry = add({Regex::Op::Split, body, next});
+                }
+            }
+            for (int i{0}; i < node.min; ++i)
+            {
+                entry = emit(child, entry);
+            }
+            return entry;
+        }
+        }
+        return next;
+    }
+
+    Regex::Program& m_program;
+    std::vector<ByteSet>& m_sets;
+};
+
+// What a node says about the strings it matches: that it only matches exact,
+// and the longest string found in all of them.
+struct Literal
+{
+    bool isExact{true};
+    std::string exact;
+    std::string required;
+};
+
+// literals longer than this aren't worth building up
+constexpr std::size_t MAX_LITERAL{256};
+
+Literal literalOf(const Node& node)
+{
+    Literal out;
+    switch (node.kind)
+    {
+    case Node::Kind::Empty:
+    case Node::Kind::LineStart:
+    case Node::Kind::LineEnd:
+        break;
+    case Node::Kind::Bytes:
+        out.isExact = node.bytes.count() == 1;
+        if (out.isExact)
+        {
+            for (unsigned byte{0}; byte < 256; ++byte)
+            {
+                if (node.bytes[byte])
+                    out.exact = static_cast<char>(byte);
+            }
+        }
+        break;
+    case Node::Kind::Concat: {
+        // runs of exact children join up into one literal
+        std::string run;
+        auto keep = [&](const std::string& candidate) {
+            if (candidate.size() > out.required.size())
+                out.required = candidate;
+        };
+        for (const Node& child : node.children)
+        {
+            Literal literal = literalOf(child);
+            if (literal.isExact && run.size() + literal.exact.size() <= MAX_LITERAL)
+            {
+                run += literal.exact;
+                continue;
+            }
+            out.isExact = false;
+            keep(run);
+            keep(literal.isExact ? literal.exact : literal.required);
+            run.clear();
+        }
+        if (out.isExact)
+            out.exact = std::move(run);
+        else
+            keep(run);
+        break;
+    }
+    case Node::Kind::Alternate: {
+        // only alternatives that are all the same string agree on one
+        Literal first = literalOf(node.children[0]);
+        out.isExact = first.isExact;
+        out.exact = first.exact;
+        for (std::size_t i{1}; i < node.children.size() && out.isExact; ++i)
+        {
+            Literal literal = literalOf(node.children[i]);
+            out.isExact = literal.isExact && literal.exact == out.exact;
+        }
+        if (!out.isExact)
+            out.exact.clear();
+        break;
+    }
+    case Node::Kind::Repeat: {
+        Literal child = literalOf(node.children[0]);
+        out.isExact = child.isExact && node.min == node.max && child.exact.size() * node.min <= MAX_LITERAL;
+        if (out.isExact)
+        {
+            for (int i{0}; i < node.min; ++i)
+            {
+                out.exact += child.exact;
+            }
+        }
+        else if (node.min > 0)
+        {
+            out.required = child.isExact ? child.exact : child.required;
+        }
+        break;
+    }
+    }
+    if (out.isExact)
+        out.required = out.exact;
+    return out;
+}
+
+} // namespace
+
+std::shared_ptr<const Regex> Regex::compile(std::string_view pattern, std::string& error)
+{
+    auto regex = std::make_shared<Regex>();
+    regex->m_pattern = pattern;
+    try
+    {
+        Node root = Parser{pattern}.parse();
+        Emitter{regex->m_program, regex->m_sets}.emit(root);
+        regex->m_literal = literalOf(root).required;
+    }
+    catch (const ParseError& parseError)
+    {
+        error = parseError.message;
+        return nullptr;
+    }
+
+    // a new class wherever some set starts or stops holding the bytes
+    int byteClass{0};
+    for (unsigned byte{0}; byte < 256; ++byte)
+    {
+        if (byte > 0 && std::ranges::any_of(regex->m_sets, [&](const ByteSet& set) {
+                return set[byte] != set[byte - 1];
+            }))
+        {
+            ++byteClass;
+        }
+        regex->m_byteClass[byte] = byteClass;
+    }
+    regex->m_classes = byteClass + 1;
+    return regex;
+}
+
+RegexMatcher::Dfa::Dfa(const Regex& regex, const Regex::Program& program, bool unanchored)
+    : m_regex{regex}, m_program{program}, m_unanchored{unanchored}, m_byteClass{regex.byteClass()},
+      m_classes{regex.classes()}, m_visited(program.insts.size())
+{
+    intern({});
+    if (m_unanchored)
+    {
+        for (bool atLineStart : {false, true})
+        {
+            ++m_visit;
+            close(m_program.start, atLineStart, false, m_startInsts[atLineStart]);
+        }
+    }
+}
+
+void RegexMatcher::Dfa::close(int pc, bool atLineStart, bool atLineEnd, std::vector<int>& out)
+{
+    m_stack.push_back(pc);
+    while (!m_stack.empty())
+    {
+        pc = m_stack.back();
+        m_stack.pop_back();
+        if (m_visited[pc] == m_visit)
+            continue;
+        m_visited[pc] = m_visit;
+
+        const Regex::Inst& inst = m_program.insts[pc];
+        switch (inst.op)
+        {
+        case Regex::Op::Split:
+            m_stack.push_back(inst.alt);
+            m_stack.push_back(inst.out);
+            break;
+        case Regex::Op::AssertStart:
+            if (atLineStart)
+                m_stack.push_back(inst.out);
+            break;
+        case Regex::Op::AssertEnd:
+            // kept in the state, to pass should the line end here
+            if (atLineEnd)
+                m_stack.push_back(inst.out);
+            else
+                out.push_back(pc);
+            break;
+        case Regex::Op::Byte:
+        case Regex::Op::Match:
+            out.push_back(pc);
+            break;
+        }
+    }
+}
+
+std::vector<int> RegexMatcher::Dfa::closure(int pc, bool atLineStart, bool atLineEnd)
+{
+    std::vector<int> out;
+    ++m_visit;
+    close(pc, atLineStart, atLineEnd, out);
+    std::ranges::sort(out);
+    return out;
+}
+
+int RegexMatcher::Dfa::intern(std::vector<int> insts)
+{
+    auto [found, added] = m_ids.try_emplace(insts, 0);
+    if (!added)
+        return found->second;
+
+    State state{std::move(insts), false, false};
+    std::vector<int> atEnd;
+    ++m_visit;
+    for (int pc : state.insts)
+    {
+        if (pc == LINE_START)
+            break;
+        const Regex::Inst& inst = m_program.insts[pc];
+        if (inst.op == Regex::Op::Match)
+            state.match = true;
+        else if (inst.op == Regex::Op::AssertEnd)
+            close(inst.out, false, true, atEnd);
+    }
+    state.matchAtEnd = state.match || std::ranges::any_of(atEnd, [&](int pc) {
+                           return m_program.insts[pc].op == Regex::Op::Match;
+                       });
+
+    int id = m_transitions.size() | (state.match ? MATCHING : 0);
+    found->second = id;
+    m_states.push_back(std::move(state));
+    m_transitions.resize(m_states.size() * m_classes, -1);
+    return id;
+}
+
+int RegexMatcher::Dfa::start(bool atLineStart)
+{
+    int& id = m_start[atLineStart];
+    if (id >= 0)
+        return id;
+
+    std::vector<int> insts;
+    if (m_unanchored)
+    {
+        // the instructions a match can start at are added at every step
+        if (atLineStart)
+            insts.push_back(LINE_START);
+    }
+    else
+    {
+        ++m_visit;
+        close(m_program.start, atLineStart, false, insts);
+        std::ranges::sort(insts);
+    }
+    id = intern(std::move(insts));
+    return id;
+}
+
+int RegexMatcher::Dfa::step(int state, unsigned char byte)
+{
+    const std::vector<int>& from = m_states[(state & ~MATCHING) / m_classes].insts;
+    bool atLineStart = !from.empty() && from[0] == LINE_START;
+
+    std::vector<int> to;
+    ++m_visit;
+    auto advance = [&](int pc) {
+        const Regex::Inst& inst = m_program.insts[pc];
+        if (inst.op == Regex::Op::Byte && m_regex.sets()[inst.set][byte])
+            close(inst.out, false, false, to);
+    };
+    if (m_unanchored)
+    {
+        for (int pc : m_startInsts[atLineStart])
+        {
+            advance(pc);
+        }
+    }
+    if (!atLineStart)
+    {
+        for (int pc : from)
+        {
+            advance(pc);
+        }
+    }
+    std::ranges::sort(to);
+
+    if (m_states.size() >= MAX_STATES)
+    {
+        // start over rather than grow without bound; the caller only holds on
+        // to the state returned
+        m_states.clear();
+        m_ids.clear();
+        m_transitions.clear();
+        m_start[0] = m_start[1] = -1;
+        ++m_flushes;
+        intern({});
+        return intern(std::move(to));
+    }
+
+    std::size_t at = (state & ~MATCHING) + m_byteClass[byte];
+    int id = intern(std::move(to));
+    m_transitions[at] = id;
+    return id;
+}
+
+RegexMatcher::Reach::Reach(const Regex& regex, Dfa& dfa)
+    : m_regex{regex}, m_dfa{dfa}, m_byteClass{regex.byteClass()}, m_classes{regex.classes()},
+      m_successors(regex.program().insts.size()), m_marked(regex.program().insts.size())
+{
+    const std::vector<Regex::Inst>& insts = m_regex.program().insts;
+    for (int pc{0}; pc < static_cast<int>(insts.size()); ++pc)
+    {
+        if (insts[pc].op == Regex::Op::Byte)
+            m_bytes.push_back(pc);
+    }
+    for (bool atLineStart : {false, true})
+    {
+        m_startInsts[atLineStart] = m_dfa.closure(m_regex.program().start, atLineStart, false);
+    }
+    m_end = intern({LINE_END});
+}
+
+bool RegexMatcher::Reach::reaches(int state, int anchored)
+{
+    State& at = m_states[state];
+    if (at.anchored != anchored || at.flushes != m_dfa.flushes())
+    {
+        at.anchored = anchored;
+        at.flushes = m_dfa.flushes();
+        at.reaches = overlaps(at.insts, m_dfa.insts(anchored));
+    }
+    return at.reaches;
+}
+
+bool RegexMatcher::Reach::overlaps(const std::vector<int>& live, const std::vector<int>& insts) const
+{
+    // both sorted, so they meet in a single pass
+    auto a = live.begin();
+    auto b = insts.begin();
+    while (a != live.end() && b != insts.end())
+    {
+        if (*a == *b)
+            return true;
+        if (*a < *b)
+            ++a;
+        else
+            ++b;
+    }
+    return false;
+}
+
+bool RegexMatcher::Reach::startsMatch(int state, bool atLineStart)
+{
+    std::int8_t& starts = m_states[state].starts[atLineStart];
+    if (starts < 0)
+        starts = overlaps(m_states[state].insts, m_startInsts[atLineStart]);
+    return starts;
+}
+
+void RegexMatcher::Reach::trim()
+{
+    if (m_states.size() < MAX_STATES)
+        return;
+    m_states.clear();
+    m_ids.clear();
+    m_transitions.clear();
+    m_end = intern({LINE_END});
+}
+
+const RegexMatcher::Reach::Successors& RegexMatcher::Reach::successors(int pc)
+{
+    Successors& out = m_successors[pc];
+    if (out.known)
+        return out;
+
+    int next = m_regex.program().insts[pc].out;
+    for (int to : m_dfa.closure(next, false, false))
+    {
+        Regex::Op op = m_regex.program().insts[to].op;
+        if (op == Regex::Op::Byte)
+            out.bytes.push_back(to);
+        else if (op == Regex::Op::Match)
+            out.match = true;
+    }
+    std::vector<int> atEnd = m_dfa.closure(next, false, true);
+    out.matchAtEnd = std::ranges::any_of(atEnd, [&](int to) {
+        return m_regex.program().insts[to].op == Regex::Op::Match;
+    });
+    out.known = true;
+    return out;
+}
+
+int RegexMatcher::Reach::intern(std::vector<int> insts)
+{
+    auto [found, added] = m_ids.try_emplace(insts, m_states.size());
+    if (!added)
+        return found->second;
+
+    if (!insts.empty() && insts[0] == LINE_END)
+        insts.clear();
+    m_states.push_back({std::move(insts)});
+    m_transitions.resize(m_states.size() * m_classes, -1);
+    return found->second;
+}
+
+int RegexMatcher::Reach::step(int state, unsigned char byte)
+{
+    // an instruction reaches a match here when taking byte ends one, or past
+    // the end of the line when one ends with it
+    bool atEnd = state == m_end;
+    ++m_mark;
+    for (int pc : m_states[state].insts)
+    {
+        m_marked[pc] = m_mark;
+    }
+
+    std::vector<int> live;
+    for (int pc : m_bytes)
+    {
+        if (!m_regex.sets()[m_regex.program().insts[pc].set][byte])
+            continue;
+        const Successors& next = successors(pc);
+        if (atEnd ? next.matchAtEnd
+                  : next.match || std::ranges::any_of(next.bytes, [&](int to) { return m_marked[to] == m_mark; }))
+        {
+            live.push_back(pc);
+        }
+    }
+
+    int id = intern(std::move(live));
+    m_transitions[state * m_classes + m_byteClass[byte]] = id;
+    return id;
+}
+
+RegexMatcher::RegexMatcher(std::shared_ptr<const Regex> regex)
+    : m_regex{std::move(regex)}, m_search{*m_regex, m_regex->program(), true},
+      m_extend{*m_regex, m_regex->program(), false}, m_reach{*m_regex, m_extend}
+{
+}
+
+bool RegexMatcher::contains(std::string_view line)
+{
+    int state = m_search.start(true);
+    for (char c : line)
+    {
+        state = m_search.next(state, c);
+        if (m_search.matching(state))
+            return true;
+    }
+    return m_search.matchingAtEnd(state);
+}
+
+std::size_t RegexMatcher::count(std::string_view line)
+{
+    return contains(line) ? matches(line).size() : 0;
+}
+
+std::vector<RegexMatch> RegexMatcher::matches(std::string_view line)
+{
+    std::vector<RegexMatch> found;
+    std::size_t n = line.size();
+
+    m_reach.trim();
+    m_reachAt.resize(n);
+    int state = m_reach.end();
+    for (std::size_t i = n; i-- > 0;)
+    {
+        state = m_reach.next(state, line[i]);
+        m_reachAt[i] = state;
+    }
+
+    // the leftmost start after the last match, taken for as long as the
+    // instructions still running can reach a further end, so a byte is only
+    // gone over again when it starts a match
+    for (std::size_t start{0}; start < n; ++start)
+    {
+        if (!m_reach.startsMatch(m_reachAt[start], start == 0))
+            continue;
+
+        std::size_t end{start};
+        state = m_extend.start(start == 0);
+        for (std::size_t i{start}; i < n && m_reach.reaches(m_reachAt[i], state); ++i)
+        {
+            state = m_extend.next(state, line[i]);
+            if (i + 1 < n ? m_extend.matching(state) : m_extend.matchingAtEnd(state))
+                end = i + 1;
+        }
+        found.push_back({start, end});
+        start = end - 1;
+    }
+    return found;
+}
@@ -0,0 +1,80 @@
+#include "rowarena.h"
+
+#include <algorithm>
+#include <new>
+
+namespace
+{
+
+// don't bother compacting arenas smaller than this
+constexpr std::size_t MIN_COMPACT_BYTES{16u << 20};
+
+} // namespace
+
+RowArena::~RowArena()
+{
+    for (void* chunk : m_chunks)
+    {
+        ::operator delete(chunk);
+    }
+}
+
+bool RowArena::fragmented() const
+{
+    return m_reserved >= MIN_COMPACT_BYTES && m_live < m_reserved / 2;
+}
+
+void* RowArena::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    ++m_allocations;
+    m_live += bytes;
+
+    std::size_t sizeClass = (bytes + GRANULARITY - 1) / GRANULARITY;
+    if (bytes > LARGEST_POOLED || alignment > GRANULARITY)
+    {
+        ++m_systemAllocations;
+        m_reserved += bytes;
+        return ::operator new(bytes, std::align_val_t{alignment});
+    }
+
+    if (FreeBlock* block = m_free[sizeClass])
+    {
+        m_free[sizeClass] = block->next;
+        return block;
+    }
+
+    std::size_t size = std::max<std::size_t>(sizeClass, 1) * GRANULARITY;
+    if (static_cast<std::size_t>(m_end - m_next) < size)
+    {
+        // the tail of the old chunk is left unused
+        ++m_systemAllocations;
+        m_reserved += CHUNK_SIZE;
+        m_next = static_cast<char*>(::operator new(CHUNK_SIZE));
+        m_end = m_next + CHUNK_SIZE;
+        m_chunks.push_back(m_next);
+    }
+
+    void* p = m_next;
+    m_next += size;
+    return p;
+}
+
+void RowArena::do_deallocate(void* p, std::size_t bytes, std::size_t alignment)
+{
+    m_live -= bytes;
+
+    if (bytes > LARGEST_POOLED || alignment > GRANULARITY)
+    {
+        m_reserved -= bytes;
+        ::operator delete(p, std::align_val_t{alignment});
+        return;
+    }
+
+    std::size_t sizeClass = (bytes + GRANULARITY - 1) / GRANULARITY;
+    m_free[sizeClass] = new (p) FreeBlock{m_free[sizeClass]};
+}
+
+bool RowArena::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+    return this == &other;
+}
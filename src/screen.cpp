@@ -0,0 +1,312 @@
+#include "screen.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+
+#include "unicode.h"
+
+namespace
+{
+
+// unchanged cells between two changed spans are rewritten instead of
+// repositioning the cursor when the gap is shorter than a cursor move
+constexpr int MERGE_GAP{8};
+
+const Cell BLANK{};
+
+// SGR sequence selecting each attribute, indexed by sgrIndex(); built once
+// so a colour change is a single append
+constexpr std::size_t SGR_COLOURS{128};
+
+std::size_t sgrIndex(Attr attr)
+{
+    return (attr.flags & ATTR_INVERSE ? SGR_COLOURS : 0) + attr.fg;
+}
+
+const std::array<std::string, 2 * SGR_COLOURS>& sgrTable()
+{
+    static const std::array<std::string, 2 * SGR_COLOURS> table = [] {
+        std::array<std::string, 2 * SGR_COLOURS> sequences;
+        for (std::size_t i{0}; i < sequences.size(); ++i)
+        {
+            std::size_t fg = i % SGR_COLOURS;
+            sequences[i] = "\x1b[0";
+            if (i >= SGR_COLOURS)
+                sequences[i] += ";7";
+            if (fg)
+                sequences[i] += std::format(";{}", fg);
+            sequences[i] += 'm';
+        }
+        return sequences;
+    }();
+    return table;
+}
+
+// bytes a packed glyph takes
+int glyphBytes(std::uint32_t glyph)
+{
+    int bytes{0};
+    for (; glyph; glyph >>= 8)
+    {
+        ++bytes;
+    }
+    return bytes;
+}
+
+void appendGlyph(std::string& out, std::uint32_t glyph)
+{
+    for (; glyph; glyph >>= 8)
+    {
+        out += static_cast<char>(glyph & 0xff);
+    }
+}
+
+} // namespace
+
+void Screen::resize(int rows, int cols)
+{
+    m_rows = rows;
+    m_cols = cols;
+    m_back.assign(static_cast<std::size_t>(rows) * cols, BLANK);
+    m_front.assign(static_cast<std::size_t>(rows) * cols, BLANK);
+    m_touched.assign(rows, true);
+    invalidate();
+}
+
+void Screen::invalidate()
+{
+    m_fullRepaint = true;
+}
+
+void Screen::scroll(int top, int bottom, int lines)
+{
+    int height = bottom - top + 1;
+    if (m_fullRepaint || lines == 0 || std::abs(lines) >= height)
+        return;
+
+    // mirror the shift in the front grid; rows scrolled in come up blank
+    Cell* first = frontRow(top);
+    Cell* last = frontRow(bottom + 1);
+    std::size_t shift = static_cast<std::size_t>(std::abs(lines)) * m_cols;
+    if (lines > 0)
+    {
+        std::copy(first + shift, last, first);
+        std::fill(last - shift, last, BLANK);
+    }
+    else
+    {
+        std::copy_backward(first, last - shift, last);
+        std::fill(first, first + shift, BLANK);
+    }
+
+    m_scrolls.push_back({top, bottom, lines});
+}
+
+void Screen::clearRow(int y)
+{
+    std::fill_n(backRow(y), m_cols, BLANK);
+    m_touched[y] = true;
+}
+
+int Screen::put(int y, int x, std::string_view text, Attr attr)
+{
+    Cell* row = backRow(y);
+    m_touched[y] = true;
+    for (std::size_t i{0}; i < text.size() && x < m_cols;)
+    {
+        unsigned char ch = text[i];
+        if (ch < 0x80)
+        {
+            row[x++] = Cell{ch, attr};
+            ++i;
+            continue;
+        }
+
+        char32_t codepoint;
+        int length = utf8Decode(text.substr(i), codepoint);
+        std::uint32_t glyph{0};
+        if (length == 1 || codepoint < 0xa0)
+        {
+            // stray bytes would leave the terminal mid-sequence and C1
+            // controls would be taken as escape sequences
+            glyph = utf8Pack(UNICODE_REPLACEMENT);
+        }
+        else
+        {
+            std::memcpy(&glyph, text.data() + i, length);
+        }
+        i += length;
+
+        int width = codepointWidth(codepoint);
+        if (width == 0)
+        {
+            // a combining mark joins the glyph before it when there is room
+            int base = x > 0 && row[x - 1].glyph == 0 ? x - 2 : x - 1;
+            int bytes = base >= 0 ? glyphBytes(row[base].glyph) : 4;
+            if (bytes + length <= 4)
+                row[base].glyph |= glyph << (8 * bytes);
+            continue;
+        }
+        if (width == 2 && x + 1 >= m_cols)
+        {
+            // half a wide glyph can't be shown
+            row[x++] = Cell{' ', attr};
+            break;
+        }
+        row[x++] = Cell{glyph, attr};
+        if (width == 2)
+            row[x++] = Cell{0, attr};
+    }
+    return x;
+}
+
+void Screen::putRow(int y, std::span<const Cell> cells)
+{
+    std::size_t count = std::min(cells.size(), static_cast<std::size_t>(m_cols));
+    Cell* row = backRow(y);
+    std::copy_n(cells.begin(), count, row);
+    std::fill(row + count, row + m_cols, BLANK);
+    m_touched[y] = true;
+}
+
+void Screen::moveTo(std::string& out, int y, int x)
+{
+    if (y == m_cursorY && x == m_cursorX)
+        return;
+
+    out += std::format("\x1b[{};{}H", y + 1, x + 1);
+    m_cursorY = y;
+    m_cursorX = x;
+}
+
+void Screen::setAttr(std::string& out, Attr attr)
+{
+    if (m_attrKnown && attr == m_attr)
+        return;
+
+    if (attr.fg < SGR_COLOURS)
+    {
+        out += sgrTable()[sgrIndex(attr)];
+    }
+    else
+    {
+        out += "\x1b[0";
+        if (attr.flags & ATTR_INVERSE)
+            out += ";7";
+        out += std::format(";{}m", attr.fg);
+    }
+
+    m_attr = attr;
+    m_attrKnown = true;
+}
+
+void Screen::flush(std::string& out, int cursorY, int cursorX)
+{
+    std::size_t start = out.size();
+
+    // hide cursor while drawing
+    out += "\x1b[?25l";
+    // scrolls and a repaint already changed m_front, so they always count
+    std::size_t bodyStart = out.size();
+
+    if (m_fullRepaint)
+    {
+        // start from a known blank screen so only non-blank cells are drawn
+        out += "\x1b[0m\x1b[2J";
+        std::fill(m_front.begin(), m_front.end(), BLANK);
+        m_attr = {};
+        m_attrKnown = true;
+        m_cursorY = m_cursorX = -1;
+        m_fullRepaint = false;
+        m_scrolls.clear();
+        std::fill(m_touched.begin(), m_touched.end(), true);
+    }
+
+    for (const ScrollOp& op : m_scrolls)
+    {
+        // scrolled in lines take the current background, so reset it first
+        setAttr(out, {});
+        out += std::format("\x1b[{};{}r", op.top + 1, op.bottom + 1);
+        out += std::format("\x1b[{}{}", std::abs(op.lines), op.lines > 0 ? 'S' : 'T');
+        out += "\x1b[r";
+        // setting the region homes the cursor
+        m_cursorY = m_cursorX = 0;
+    }
+    m_scrolls.clear();
+
+    for (int y{0}; y < m_rows; ++y)
+    {
+        if (!m_touched[y])
+            continue;
+        m_touched[y] = false;
+
+        const Cell* next = backRow(y);
+        Cell* prev = frontRow(y);
+
+        // everything from blankFrom to the end of the row can be erased with EL
+        int blankFrom = m_cols;
+        while (blankFrom > 0 && next[blankFrom - 1] == BLANK)
+        {
+            --blankFrom;
+        }
+
+        int x{0};
+        while (x < m_cols)
+        {
+            if (next[x] == prev[x])
+            {
+                ++x;
+                continue;
+            }
+
+            // a wide glyph is written whole, whichever half of it changed
+            if (x > 0 && next[x].glyph == 0)
+                --x;
+
+            int lastChanged = x;
+            for (int k{x + 1}; k < m_cols && k - lastChanged <= MERGE_GAP; ++k)
+            {
+                if (next[k] != prev[k])
+                    lastChanged = k;
+            }
+            int end = lastChanged + 1;
+            if (end < m_cols && next[end].glyph == 0)
+                ++end;
+
+            moveTo(out, y, x);
+            int drawEnd = std::min(end, std::max(x, blankFrom));
+            for (int k{x}; k < drawEnd; ++k)
+            {
+                setAttr(out, next[k].attr);
+                appendGlyph(out, next[k].glyph);
+            }
+            m_cursorX = drawEnd;
+
+            if (drawEnd < end)
+            {
+                setAttr(out, {});
+                out += "\x1b[K";
+                end = m_cols;
+            }
+            // the cursor is left in the pending wrap state after the last column
+            if (m_cursorX >= m_cols)
+                m_cursorY = m_cursorX = -1;
+
+            std::copy(next + x, next + end, prev + x);
+            x = end;
+        }
+    }
+
+    if (out.size() == bodyStart && cursorY == m_cursorY && cursorX == m_cursorX)
+    {
+        // nothing changed, not even the cursor
+        out.resize(start);
+        return;
+    }
+
+    moveTo(out, cursorY, cursorX);
+    out += "\x1b[?25h";
+}
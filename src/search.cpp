@@ -0,0 +1,678 @@
+#include "search.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iterator>
+#include <thread>
+#include <utility>
+
+#include "parallel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KILO_X86 1
+#endif
+
+namespace
+{
+
+// below this many bytes a slice of the buffer is not worth a thread
+constexpr std::size_t MIN_SLICE_SIZE{1u << 20};
+// and below this many rows a slice of candidates
+constexpr std::size_t MIN_SLICE_ROWS{1u << 15};
+// a replace all searches and rebuilds this many rows at a time, checking for
+// cancellation in between
+constexpr int REPLACE_CHUNK_ROWS{1 << 18};
+
+// A query with its Horspool shift table: how far the window can move when
+// its last byte is a given one. Built once per search.
+struct Needle
+{
+    explicit Needle(std::string_view query) : text{query}
+    {
+        shift.fill(text.size());
+        for (std::size_t i{0}; i + 1 < text.size(); ++i)
+        {
+            shift[static_cast<unsigned char>(text[i])] = text.size() - 1 - i;
+        }
+    }
+
+    std::string_view text;
+    std::array<std::size_t, 256> shift;
+};
+
+// Every finder returns the first occurrence of a non-empty needle in
+// [begin, end), or nullptr when there is none.
+using Finder = const char* (*)(const char* begin, const char* end, const Needle& needle);
+
+const char* findScalar(const char* begin, const char* end, const Needle& needle)
+{
+    std::size_t n = needle.text.size();
+    if (n == 1)
+        return static_cast<const char*>(std::memchr(begin, needle.text[0], end - begin));
+    if (static_cast<std::size_t>(end - begin) < n)
+        return nullptr;
+
+    unsigned char last = needle.text[n - 1];
+    for (const char* p = begin; p <= end - n;)
+    {
+        unsigned char c = p[n - 1];
+        if (c == last && std::memcmp(p, needle.text.data(), n - 1) == 0)
+            return p;
+        p += needle.shift[c];
+    }
+    return nullptr;
+}
+
+#ifdef KILO_X86
+// The vector finders compare the needle's first and last bytes against a
+// block of positions at once, and only where both match compare the bytes
+// between. The end of the range that doesn't fill a block is left to the
+// scalar finder.
+
+// compares the middle of the needle at every candidate in mask
+inline const char* verify(const char* p, unsigned mask, const Needle& needle)
+{
+    std::size_t middle = needle.text.size() > 2 ? needle.text.size() - 2 : 0;
+    while (mask)
+    {
+        int bit = __builtin_ctz(mask);
+        if (std::memcmp(p + bit + 1, needle.text.data() + 1, middle) == 0)
+            return p + bit;
+        mask &= mask - 1;
+    }
+    return nullptr;
+}
+
+const char* findSse2(const char* begin, const char* end, const Needle& needle)
+{
+    std::size_t n = needle.text.size();
+    const __m128i first = _mm_set1_epi8(needle.text[0]);
+    const __m128i last = _mm_set1_epi8(needle.text[n - 1]);
+
+    const char* p = begin;
+    for (; static_cast<std::size_t>(end - p) >= n + 15; p += 16)
+    {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + n - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+        if (const char* match = verify(p, mask, needle))
+            return match;
+    }
+    return findScalar(p, end, needle);
+}
+
+__attribute__((target("avx2"))) const char* findAvx2(const char* begin, const char* end, const Needle& needle)
+{
+    std::size_t n = needle.text.size();
+    const __m256i first = _mm256_set1_epi8(needle.text[0]);
+    const __m256i last = _mm256_set1_epi8(needle.text[n - 1]);
+
+    const char* p = begin;
+    for (; static_cast<std::size_t>(end - p) >= n + 31; p += 32)
+    {
+        __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + n - 1));
+        unsigned mask =
+            _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+        if (const char* match = verify(p, mask, needle))
+            return match;
+    }
+    return findScalar(p, end, needle);
+}
+#endif
+
+Finder pickFinder(SearchKernel kernel)
+{
+#ifdef KILO_X86
+    if (kernel == SearchKernel::Auto)
+        kernel = __builtin_cpu_supports("avx2") ? SearchKernel::Avx2 : SearchKernel::Sse2;
+
+    switch (kernel)
+    {
+    case SearchKernel::Avx2:
+        return findAvx2;
+    case SearchKernel::Sse2:
+        return findSse2;
+    default:
+        return findScalar;
+    }
+#else
+    return findScalar;
+#endif
+}
+
+// matches of needle in [begin, end), each search starting after the last match
+std::size_t countMatches(const char* begin, const char* end, Finder find, const Needle& needle)
+{
+    std::size_t count{0};
+    for (const char* p = begin; (p = find(p, end, needle)); p += needle.text.size())
+    {
+        ++count;
+    }
+    return count;
+}
+
+std::size_t countMatches(std::string_view text, Finder find, const Needle& needle)
+{
+    return countMatches(text.data(), text.data() + text.size(), find, needle);
+}
+
+// appends the lines from first to last of a run that contain needle, as rows
+// with how many times they contain it
+void scanLines(const SearchSpan& span, std::size_t first, std::size_t last, Finder find, const Needle& needle,
+               SearchResult& out)
+{
+    // the run's lines lie one after another in the file, so they are searched
+    // as one block and only matches are mapped back to lines
+    const LineIndex& lines = *span.lines;
+    const char* data = span.text.data();
+    const char* p = data + lines.start(first);
+    const char* end = data + lines.start(last);
+    std::size_t line = first;
+    while (const char* match = find(p, end, needle))
+    {
+        line = lines.lineAt(match - data, line);
+        std::string_view text = lines.line(span.text, line);
+        const char* lineEnd = text.data() + text.size();
+        if (match + needle.text.size() > lineEnd)
+        {
+            // ran into the line break
+            p = match + 1;
+            continue;
+        }
+        out.rows.push_back(span.row + static_cast<int>(line - span.firstLine));
+        out.counts.push_back(1 + countMatches(match + needle.text.size(), lineEnd, find, needle));
+        p = data + lines.start(line + 1);
+    }
+}
+
+// appends the rows from first to last of span that contain needle, with how
+// many times they do; a run is only scanned in blocks, when given
+void scanSpan(const SearchSpan& span, int first, int last, Finder find, const Needle& needle,
+              const std::vector<std::uint32_t>* blocks, SearchResult& out)
+{
+    if (!span.lines)
+    {
+        if (std::size_t count = countMatches(span.text, find, needle))
+        {
+            out.rows.push_back(span.row);
+            out.counts.push_back(count);
+        }
+        return;
+    }
+
+    std::size_t from = span.firstLine + first;
+    std::size_t to = span.firstLine + last;
+    if (!blocks)
+    {
+        scanLines(span, from, to, find, needle, out);
+        return;
+    }
+
+    constexpr std::size_t BLOCK_LINES{TrigramIndex::BLOCK_LINES};
+    for (auto block = std::ranges::lower_bound(*blocks, from / BLOCK_LINES);
+         block != blocks->end() && *block * BLOCK_LINES < to; ++block)
+    {
+        scanLines(span, std::max<std::size_t>(from, *block * BLOCK_LINES),
+                  std::min<std::size_t>(to, (*block + 1) * BLOCK_LINES), find, needle, out);
+    }
+}
+
+// appends the rows from first to last of span that match, with how many
+// times they do
+void scanSpan(const SearchSpan& span, int first, int last, RegexMatcher& matcher, SearchResult& out)
+{
+    for (int i{first}; i < last; ++i)
+    {
+        std::string_view text = span.lines ? span.lines->line(span.text, span.firstLine + i) : span.text;
+        if (std::size_t count = matcher.count(text))
+        {
+            out.rows.push_back(span.row + i);
+            out.counts.push_back(count);
+        }
+    }
+}
+
+// the slices' rows joined up, with their counts made running totals
+std::shared_ptr<SearchResult> joinSlices(const std::vector<SearchResult>& found)
+{
+    auto result = std::make_shared<SearchResult>();
+    for (const SearchResult& slice : found)
+    {
+        result->rows.insert(result->rows.end(), slice.rows.begin(), slice.rows.end());
+        for (std::size_t count : slice.counts)
+        {
+            result->counts.push_back(result->total() + count);
+        }
+    }
+    return result;
+}
+
+std::size_t spanBytes(const SearchSpan& span)
+{
+    if (!span.lines)
+        return span.text.size() + 1;
+    return span.lines->start(span.firstLine + span.count) - span.lines->start(span.firstLine);
+}
+
+} // namespace
+
+bool TextSearch::kernelSupported(SearchKernel kernel)
+{
+    switch (kernel)
+    {
+#ifdef KILO_X86
+    case SearchKernel::Avx2:
+        return __builtin_cpu_supports("avx2");
+    case SearchKernel::Sse2:
+        return true;
+#else
+    case SearchKernel::Avx2:
+    case SearchKernel::Sse2:
+        return false;
+#endif
+    default:
+        return true;
+    }
+}
+
+void TextSearch::reset(std::vector<SearchSpan> spans, const TrigramIndex* index)
+{
+    m_spans = std::move(spans);
+    m_index = index;
+    m_results.clear();
+
+    m_offsets.resize(m_spans.size() + 1);
+    m_offsets[0] = 0;
+    for (std::size_t i{0}; i < m_spans.size(); ++i)
+    {
+        m_offsets[i + 1] = m_offsets[i] + spanBytes(m_spans[i]);
+    }
+    m_rows = m_spans.empty() ? 0 : m_spans.back().row + m_spans.back().count;
+}
+
+std::string_view TextSearch::rowText(int row) const
+{
+    auto after = std::ranges::upper_bound(m_spans, row, {}, &SearchSpan::row);
+    const SearchSpan& span = *std::prev(after);
+    if (!span.lines)
+        return span.text;
+    return span.lines->line(span.text, span.firstLine + (row - span.row));
+}
+
+// the first row starting at or after byte
+TextSearch::Position TextSearch::locate(std::size_t byte) const
+{
+    if (byte >= m_offsets.back())
+        return {m_spans.size(), 0};
+
+    std::size_t i = std::ranges::upper_bound(m_offsets, byte) - m_offsets.begin() - 1;
+    const SearchSpan& span = m_spans[i];
+    std::size_t into = byte - m_offsets[i];
+    if (into == 0)
+        return {i, 0};
+    if (!span.lines)
+        return {i + 1, 0};
+
+    std::size_t offset = span.lines->start(span.firstLine) + into;
+    std::size_t line = span.lines->lineAt(offset);
+    if (span.lines->start(line) < offset)
+        ++line;
+    return {i, static_cast<int>(line - span.firstLine)};
+}
+
+std::shared_ptr<const SearchResult> TextSearch::search(std::string_view query, unsigned threads, SearchKernel kernel)
+{
+    if (query.empty())
+        return std::make_shared<const SearchResult>();
+
+    while (!m_results.empty() && !query.starts_with(m_results.back()->query))
+    {
+        m_results.pop_back();
+    }
+    if (!m_results.empty() && m_results.back()->query == query)
+        return m_results.back();
+
+    Finder find = pickFinder(kernel);
+    Needle needle{query};
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // every slice of the work finds its rows in order, counts not yet summed
+    std::vector<SearchResult> found;
+    // a row containing query contains every prefix of it, so only the rows
+    // that matched the longest prefix need looking at; when they are most of
+    // the buffer, scanning the runs whole is faster than row by row
+    if (!m_results.empty() && m_results.back()->rows.size() < static_cast<std::size_t>(m_rows) / 4)
+    {
+        const std::vector<int>& candidates = m_results.back()->rows;
+        std::size_t sliceCount = std::clamp<std::size_t>(candidates.size() / MIN_SLICE_ROWS, 1, threads);
+        found.resize(sliceCount);
+        parallelFor(sliceCount, [&](unsigned i) {
+            std::size_t begin = candidates.size() * i / sliceCount;
+            std::size_t end = candidates.size() * (i + 1) / sliceCount;
+            for (std::size_t k{begin}; k < end; ++k)
+            {
+                if (std::size_t count = countMatches(rowText(candidates[k]), find, needle))
+                {
+                    found[i].rows.push_back(candidates[k]);
+                    found[i].counts.push_back(count);
+                }
+            }
+        });
+    }
+    else
+    {
+        // the index leaves only the blocks of the runs holding every trigram
+        // of query to scan
+        std::optional<std::vector<std::uint32_t>> blocks;
+        if (m_index)
+            blocks = m_index->candidates(query);
+
+        // every slice takes the rows starting in its share of the bytes
+        std::size_t bytes = m_offsets.back();
+        std::size_t sliceCount = std::clamp<std::size_t>(bytes / MIN_SLICE_SIZE, 1, threads);
+        found.resize(sliceCount);
+        parallelFor(sliceCount, [&](unsigned i) {
+            Position from = locate(bytes * i / sliceCount);
+            Position to = locate(bytes * (i + 1) / sliceCount);
+            for (std::size_t k{from.span}; k < m_spans.size() && k <= to.span; ++k)
+            {
+                int first = k == from.span ? from.row : 0;
+                int last = k == to.span ? to.row : m_spans[k].count;
+                if (first < last)
+                    scanSpan(m_spans[k], first, last, find, needle, blocks ? &*blocks : nullptr, found[i]);
+            }
+        });
+    }
+
+    std::shared_ptr<SearchResult> result = joinSlices(found);
+    result->query = query;
+    m_results.push_back(std::move(result));
+    return m_results.back();
+}
+
+std::shared_ptr<const SearchResult> TextSearch::searchRegex(const std::shared_ptr<const Regex>& regex, unsigned threads,
+                                                            SearchKernel kernel)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // every slice runs its own DFA, the states it builds can't be shared
+    std::vector<SearchResult> found;
+    if (!regex->literal().empty())
+    {
+        std::shared_ptr<const SearchResult> candidates = search(regex->literal(), threads, kernel);
+        const std::vector<int>& rows = candidates->rows;
+        std::size_t sliceCount = std::clamp<std::size_t>(rows.size() / MIN_SLICE_ROWS, 1, threads);
+        found.resize(sliceCount);
+        parallelFor(sliceCount, [&](unsigned i) {
+            RegexMatcher matcher{regex};
+            std::size_t begin = rows.size() * i / sliceCount;
+            std::size_t end = rows.size() * (i + 1) / sliceCount;
+            for (std::size_t k{begin}; k < end; ++k)
+            {
+                if (std::size_t count = matcher.count(rowText(rows[k])))
+                {
+                    found[i].rows.push_back(rows[k]);
+                    found[i].counts.push_back(count);
+                }
+            }
+        });
+    }
+    else
+    {
+        std::size_t bytes = m_offsets.back();
+        std::size_t sliceCount = std::clamp<std::size_t>(bytes / MIN_SLICE_SIZE, 1, threads);
+        found.resize(sliceCount);
+        parallelFor(sliceCount, [&](unsigned i) {
+            RegexMatcher matcher{regex};
+            Position from = locate(bytes * i / sliceCount);
+            Position to = locate(bytes * (i + 1) / sliceCount);
+            for (std::size_t k{from.span}; k < m_spans.size() && k <= to.span; ++k)
+            {
+                int first = k == from.span ? from.row : 0;
+                int last = k == to.span ? to.row : m_spans[k].count;
+                scanSpan(m_spans[k], first, last, matcher, found[i]);
+            }
+        });
+    }
+
+    std::shared_ptr<SearchResult> result = joinSlices(found);
+    result->query = regex->pattern();
+    result->regex = true;
+    return result;
+}
+
+Replacement TextSearch::replace(const SearchResult& matches, const std::shared_ptr<const Regex>& regex,
+                                std::string_view replacement, unsigned threads) const
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    const std::vector<int>& rows = matches.rows;
+    Finder find = pickFinder(SearchKernel::Auto);
+    Needle needle{matches.query};
+    std::size_t sliceCount = std::clamp<std::size_t>(rows.size() / MIN_SLICE_ROWS, 1, threads);
+    std::vector<Replacement> slices(sliceCount);
+    parallelFor(sliceCount, [&](unsigned i) {
+        Replacement& slice = slices[i];
+        std::optional<RegexMatcher> matcher;
+        if (regex)
+            matcher.emplace(regex);
+        std::vector<RegexMatch> found;
+        std::size_t begin = rows.size() * i / sliceCount;
+        std::size_t end = rows.size() * (i + 1) / sliceCount;
+        for (std::size_t k{begin}; k < end; ++k)
+        {
+            std::string_view text = rowText(rows[k]);
+            if (matcher)
+            {
+                found = matcher->matches(text);
+            }
+            else
+            {
+                // where the search counted them, each after the one before
+                found.clear();
+                const char* textEnd = text.data() + text.size();
+                for (const char* p = text.data(); (p = find(p, textEnd, needle)); p += needle.text.size())
+                {
+                    std::size_t at = p - text.data();
+                    found.push_back({at, at + needle.text.size()});
+                }
+            }
+
+            std::string out;
+            out.reserve(text.size() + found.size() * replacement.size());
+            std::size_t pos{0};
+            for (RegexMatch match : found)
+            {
+                out.append(text.substr(pos, match.start - pos));
+                out.append(replacement);
+                pos = match.end;
+            }
+            out.append(text.substr(pos));
+            // a replacement equal to the text it replaces leaves the row as it was
+            if (out == text)
+                continue;
+            slice.rows.push_back(rows[k]);
+            slice.texts.push_back(std::move(out));
+            slice.count += found.size();
+        }
+    });
+
+    Replacement replaced = std::move(slices[0]);
+    for (std::size_t i{1}; i < sliceCount; ++i)
+    {
+        replaced.rows.insert(replaced.rows.end(), slices[i].rows.begin(), slices[i].rows.end());
+        std::move(slices[i].texts.begin(), slices[i].texts.end(), std::back_inserter(replaced.texts));
+        replaced.count += slices[i].count;
+    }
+    return replaced;
+}
+
+Replacer::Replacer(std::vector<SearchSpan> spans, const TrigramIndex* index, std::string query,
+                   std::shared_ptr<const Regex> regex, std::string replacement, std::function<void()> notify)
+{
+    m_thread = std::thread{[this, spans = std::move(spans), index, query = std::move(query), regex = std::move(regex),
+                            replacement = std::move(replacement), notify = std::move(notify)]() mutable {
+        TextSearch search;
+        Replacement replaced;
+        std::size_t next{0};
+        while (next < spans.size())
+        {
+            // the next chunk of rows, splitting a run of lines where it ends
+            std::vector<SearchSpan> chunk;
+            int rows{0};
+            while (next < spans.size() && rows < REPLACE_CHUNK_ROWS)
+            {
+                SearchSpan& span = spans[next];
+                int count = std::min(span.count, REPLACE_CHUNK_ROWS - rows);
+                chunk.push_back({span.row, count, span.text, span.lines, span.firstLine});
+                rows += count;
+                if (count == span.count)
+                {
+                    ++next;
+                    continue;
+                }
+                span.row += count;
+                span.count -= count;
+                span.firstLine += count;
+            }
+
+            search.reset(std::move(chunk), index);
+            std::shared_ptr<const SearchResult> matches = regex ? search.searchRegex(regex) : search.search(query);
+            Replacement part = search.replace(*matches, regex, replacement);
+            replaced.rows.insert(replaced.rows.end(), part.rows.begin(), part.rows.end());
+            std::move(part.texts.begin(), part.texts.end(), std::back_inserter(replaced.texts));
+            replaced.count += part.count;
+
+            if (m_cancel.load(std::memory_order_relaxed))
+                return;
+            m_rowsDone.fetch_add(rows, std::memory_order_relaxed);
+            if (next < spans.size())
+                notify();
+        }
+
+        {
+            std::lock_guard lock{m_mutex};
+            m_result = std::move(replaced);
+        }
+        notify();
+    }};
+}
+
+Replacer::~Replacer()
+{
+    m_cancel = true;
+    m_thread.join();
+}
+
+int Replacer::rowsDone() const
+{
+    return m_rowsDone.load(std::memory_order_relaxed);
+}
+
+std::optional<Replacement> Replacer::take()
+{
+    std::lock_guard lock{m_mutex};
+    return std::exchange(m_result, std::nullopt);
+}
+
+SearchWorker::SearchWorker(std::function<void()> notify) : m_notify{std::move(notify)}
+{
+    m_thread = std::thread{&SearchWorker::run, this};
+}
+
+SearchWorker::~SearchWorker()
+{
+    {
+        std::lock_guard lock{m_mutex};
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void SearchWorker::reset(std::vector<SearchSpan> spans, const TrigramIndex* index)
+{
+    {
+        std::lock_guard lock{m_mutex};
+        m_pending.reset();
+        m_finished.reset();
+        ++m_generation;
+    }
+    std::lock_guard searching{m_searching};
+    m_search.reset(std::move(spans), index);
+}
+
+void SearchWorker::submit(std::string query)
+{
+    {
+        std::lock_guard lock{m_mutex};
+        m_pending = Query{std::move(query), nullptr};
+    }
+    m_wake.notify_one();
+}
+
+void SearchWorker::submit(std::shared_ptr<const Regex> regex)
+{
+    {
+        std::lock_guard lock{m_mutex};
+        m_pending = Query{regex->pattern(), std::move(regex)};
+    }
+    m_wake.notify_one();
+}
+
+std::shared_ptr<const SearchResult> SearchWorker::takeFinished()
+{
+    std::lock_guard lock{m_mutex};
+    return std::exchange(m_finished, nullptr);
+}
+
+std::shared_ptr<const SearchResult> SearchWorker::wait()
+{
+    std::unique_lock lock{m_mutex};
+    m_done.wait(lock, [this] { return !m_pending && !m_busy; });
+    return std::exchange(m_finished, nullptr);
+}
+
+void SearchWorker::run()
+{
+    while (true)
+    {
+        Query query;
+        std::uint64_t generation;
+        {
+            std::unique_lock lock{m_mutex};
+            m_wake.wait(lock, [this] { return m_stop || m_pending; });
+            if (m_stop)
+                return;
+
+            query = std::move(*m_pending);
+            m_pending.reset();
+            m_busy = true;
+            generation = m_generation;
+        }
+
+        std::shared_ptr<const SearchResult> result;
+        {
+            std::lock_guard searching{m_searching};
+            result = query.regex ? m_search.searchRegex(query.regex) : m_search.search(query.text);
+        }
+
+        bool current;
+        {
+            std::lock_guard lock{m_mutex};
+            m_busy = false;
+            current = generation == m_generation;
+            if (current)
+                m_finished = std::move(result);
+        }
+        m_done.notify_all();
+        if (current)
+            m_notify();
+    }
+}
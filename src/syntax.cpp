@@ -0,0 +1,293 @@
+#include "syntax.h"
+
+#include <algorithm>
+#include <array>
+
+namespace
+{
+
+/* filetypes */
+
+// Each language is a list of regions (comments and strings) and keywords, a
+// trailing '|' marking a secondary keyword. Both are compiled into
+// GrammarTables at compile time.
+
+constexpr std::array<std::string_view, 3> C_HL_extensions{".c", ".h", ".cpp"};
+constexpr std::array<std::string_view, 23> C_HL_keywords{
+    "switch", "if",      "while",   "for",    "break",     "continue", "return", "else",
+    "struct", "union",   "typedef", "static", "enum",      "class",    "case",   "int|",
+    "long|",  "double|", "float|",  "char|",  "unsigned|", "signed|",  "void|"};
+constexpr std::array<SyntaxRegion, 4> C_HL_regions{{
+    {"//", "", HL_COMMENT},
+    {"/*", "*/", HL_MLCOMMENT, '\0', true},
+    {"\"", "\"", HL_STRING, '\\'},
+    {"'", "'", HL_STRING, '\\'},
+}};
+constexpr GrammarTables C_HL_tables{C_HL_regions, C_HL_keywords};
+
+constexpr std::array<std::string_view, 2> PY_HL_extensions{".py", ".pyw"};
+constexpr std::array<std::string_view, 47> PY_HL_keywords{
+    "and",    "as",     "assert", "async",  "await",    "break", "class", "continue", "def",     "del",
+    "elif",   "else",   "except", "finally", "for",     "from",  "global", "if",      "import",  "in",
+    "is",     "lambda", "nonlocal", "not",  "or",       "pass",  "raise", "return",   "try",     "while",
+    "with",   "yield",  "match",  "case",   "True|",    "False|", "None|", "self|",   "int|",    "float|",
+    "str|",   "bytes|", "bool|",  "list|",  "dict|",    "set|",  "tuple|"};
+constexpr std::array<SyntaxRegion, 5> PY_HL_regions{{
+    {"#", "", HL_COMMENT},
+    {"\"\"\"", "\"\"\"", HL_STRING, '\\', true},
+    {"'''", "'''", HL_STRING, '\\', true},
+    {"\"", "\"", HL_STRING, '\\'},
+    {"'", "'", HL_STRING, '\\'},
+}};
+constexpr GrammarTables PY_HL_tables{PY_HL_regions, PY_HL_keywords};
+
+constexpr std::array<std::string_view, 1> RS_HL_extensions{".rs"};
+constexpr std::array<std::string_view, 59> RS_HL_keywords{
+    "as",     "async", "await", "break",  "const",  "continue", "crate",  "dyn",    "else",    "enum",
+    "extern", "fn",    "for",   "if",     "impl",   "in",       "let",    "loop",   "match",   "mod",
+    "move",   "mut",   "pub",   "ref",    "return", "self",     "Self",   "static", "struct",  "super",
+    "trait",  "type",  "unsafe", "use",   "where",  "while",    "i8|",    "i16|",   "i32|",    "i64|",
+    "i128|",  "isize|", "u8|",  "u16|",   "u32|",   "u64|",     "u128|",  "usize|", "f32|",    "f64|",
+    "bool|",  "char|", "str|",  "String|", "Vec|",  "Option|",  "Result|", "true|", "false|"};
+// no region for '\'': it also starts lifetimes
+constexpr std::array<SyntaxRegion, 3> RS_HL_regions{{
+    {"//", "", HL_COMMENT},
+    {"/*", "*/", HL_MLCOMMENT, '\0', true},
+    {"\"", "\"", HL_STRING, '\\', true},
+}};
+constexpr GrammarTables RS_HL_tables{RS_HL_regions, RS_HL_keywords};
+
+constexpr std::array<std::string_view, 1> GO_HL_extensions{".go"};
+constexpr std::array<std::string_view, 50> GO_HL_keywords{
+    "break",     "case",     "chan",     "const",   "continue", "default",  "defer",    "else",    "fallthrough",
+    "for",       "func",     "go",       "goto",    "if",       "import",   "interface", "map",    "package",
+    "range",     "return",   "select",   "struct",  "switch",   "type",     "var",      "bool|",   "byte|",
+    "complex64|", "complex128|", "error|", "float32|", "float64|", "int|",  "int8|",    "int16|",  "int32|",
+    "int64|",    "rune|",    "string|",  "uint|",   "uint8|",   "uint16|",  "uint32|",  "uint64|", "uintptr|",
+    "any|",      "true|",    "false|",   "nil|",    "iota|"};
+constexpr std::array<SyntaxRegion, 5> GO_HL_regions{{
+    {"//", "", HL_COMMENT},
+    {"/*", "*/", HL_MLCOMMENT, '\0', true},
+    {"\"", "\"", HL_STRING, '\\'},
+    {"'", "'", HL_STRING, '\\'},
+    {"`", "`", HL_STRING, '\0', true},
+}};
+constexpr GrammarTables GO_HL_tables{GO_HL_regions, GO_HL_keywords};
+
+constexpr std::array<std::string_view, 1> JSON_HL_extensions{".json"};
+constexpr std::array<std::string_view, 3> JSON_HL_keywords{"true|", "false|", "null|"};
+constexpr std::array<SyntaxRegion, 1> JSON_HL_regions{{
+    {"\"", "\"", HL_STRING, '\\'},
+}};
+constexpr GrammarTables JSON_HL_tables{JSON_HL_regions, JSON_HL_keywords};
+
+constexpr std::array<std::string_view, 2> YAML_HL_extensions{".yaml", ".yml"};
+constexpr std::array<std::string_view, 10> YAML_HL_keywords{"true|", "false|", "null|", "yes|", "no|",
+                                                            "on|",   "off|",   "True|", "False|", "Null|"};
+constexpr std::array<SyntaxRegion, 3> YAML_HL_regions{{
+    {"#", "", HL_COMMENT},
+    {"\"", "\"", HL_STRING, '\\'},
+    {"'", "'", HL_STRING},
+}};
+constexpr GrammarTables YAML_HL_tables{YAML_HL_regions, YAML_HL_keywords};
+
+constexpr std::array<std::string_view, 5> SH_HL_extensions{".sh", ".bash", ".zsh", ".bashrc", ".profile"};
+constexpr std::array<std::string_view, 36> SH_HL_keywords{
+    "if",      "then",     "else",   "elif",   "fi",     "case",   "esac",    "for",    "while",
+    "until",   "do",       "done",   "in",     "function", "select", "return", "break",  "continue",
+    "local",   "export",   "readonly", "declare", "unset", "shift", "exit",   "echo|",  "printf|",
+    "read|",   "cd|",      "test|",  "source|", "eval|", "exec|",  "set|",    "trap|",  "alias|"};
+constexpr std::array<SyntaxRegion, 4> SH_HL_regions{{
+    {"#", "", HL_COMMENT},
+    {"\"", "\"", HL_STRING, '\\', true},
+    {"'", "'", HL_STRING, '\0', true},
+    {"`", "`", HL_STRING, '\\', true},
+}};
+constexpr GrammarTables SH_HL_tables{SH_HL_regions, SH_HL_keywords};
+
+constexpr std::array<EditorSyntax, 7> HLDB{{
+    {"c", C_HL_extensions, C_HL_keywords, C_HL_regions, &C_HL_tables, HL_HIGHLIGHT_NUMBERS},
+    {"python", PY_HL_extensions, PY_HL_keywords, PY_HL_regions, &PY_HL_tables, HL_HIGHLIGHT_NUMBERS},
+    {"rust", RS_HL_extensions, RS_HL_keywords, RS_HL_regions, &RS_HL_tables, HL_HIGHLIGHT_NUMBERS},
+    {"go", GO_HL_extensions, GO_HL_keywords, GO_HL_regions, &GO_HL_tables, HL_HIGHLIGHT_NUMBERS},
+    {"json", JSON_HL_extensions, JSON_HL_keywords, JSON_HL_regions, &JSON_HL_tables, HL_HIGHLIGHT_NUMBERS},
+    {"yaml", YAML_HL_extensions, YAML_HL_keywords, YAML_HL_regions, &YAML_HL_tables, HL_HIGHLIGHT_NUMBERS},
+    {"shell", SH_HL_extensions, SH_HL_keywords, SH_HL_regions, &SH_HL_tables, HL_HIGHLIGHT_NUMBERS},
+}};
+
+// longest run a HighlightRun can describe, longer ones are split
+constexpr std::size_t MAX_RUN_LENGTH{(1u << 24) - 1};
+
+// appends [start, start + length) as hl, extending the last run when it
+// continues it
+void addRun(HighlightRuns& runs, std::size_t start, std::size_t length, int hl)
+{
+    if (!length || hl == HL_NORMAL)
+        return;
+
+    if (!runs.empty())
+    {
+        HighlightRun& last = runs.back();
+        if (last.hl == hl && last.start + last.length == start && last.length + length <= MAX_RUN_LENGTH)
+        {
+            last.length += length;
+            return;
+        }
+    }
+
+    for (; length > MAX_RUN_LENGTH; start += MAX_RUN_LENGTH, length -= MAX_RUN_LENGTH)
+    {
+        runs.push_back({static_cast<std::uint32_t>(start), MAX_RUN_LENGTH, static_cast<std::uint32_t>(hl)});
+    }
+    runs.push_back({static_cast<std::uint32_t>(start), static_cast<std::uint32_t>(length), static_cast<std::uint32_t>(hl)});
+}
+
+// the highlighter proper, shared by whole lines and spans of long ones
+SyntaxCheckpoint highlightSpan(const EditorSyntax& syntax, std::string_view render, SyntaxCheckpoint at,
+                               std::size_t until, HighlightRuns& highlight)
+{
+    const GrammarTables& tables = *syntax.tables;
+    bool numbers = syntax.flags & HL_HIGHLIGHT_NUMBERS;
+    std::size_t n = render.size();
+    std::size_t limit = std::min(until, n);
+
+    bool isPrevSeparator = at.prevSeparator;
+    // end of the last number seen, a '.' or digit right after it continues it
+    std::size_t numberEnd = at.inNumber ? at.pos : std::string_view::npos;
+    int region = at.region;
+
+    std::size_t i{at.pos};
+    while (i < limit)
+    {
+        if (region >= 0)
+        {
+            // inside a comment or string: run to the closer, the end of the line
+            // or, for regions without a closer, just the end of the line; a
+            // span ending first leaves the region open at its limit
+            const SyntaxRegion& r = tables.region(region);
+            std::size_t end = limit;
+            bool closed = false;
+            if (!r.close.empty())
+            {
+                char closeFirst = r.close[0];
+                std::size_t j{i};
+                for (; j < limit; ++j)
+                {
+                    char c = render[j];
+                    if (c == r.escape && r.escape)
+                    {
+                        ++j;
+                        continue;
+                    }
+                    if (c == closeFirst && render.substr(j).starts_with(r.close))
+                    {
+                        closed = true;
+                        break;
+                    }
+                }
+                end = closed ? j + r.close.size() : std::min(j, n);
+            }
+
+            addRun(highlight, i, end - i, r.highlight);
+            i = end;
+            if (!closed)
+                break;
+            region = -1;
+            isPrevSeparator = true;
+            continue;
+        }
+
+        char c = render[i];
+        std::uint8_t cls = tables.byteClass(c);
+
+        if (cls & GrammarTables::CLASS_OPENER)
+        {
+            region = tables.matchOpener(render.substr(i));
+            if (region >= 0)
+            {
+                std::size_t openLength = tables.region(region).open.size();
+                addRun(highlight, i, openLength, tables.region(region).highlight);
+                i += openLength;
+                continue;
+            }
+        }
+
+        if (numbers)
+        {
+            bool inNumber = numberEnd == i;
+            if (((cls & GrammarTables::CLASS_DIGIT) && (isPrevSeparator || inNumber)) || (c == '.' && inNumber))
+            {
+                addRun(highlight, i, 1, HL_NUMBER);
+                numberEnd = ++i;
+                isPrevSeparator = false;
+                continue;
+            }
+        }
+
+        if (isPrevSeparator && (cls & GrammarTables::CLASS_IDENTIFIER_START))
+        {
+            // one hash and one compare per identifier, then skip past it
+            std::size_t end = i + 1;
+            while (end < n && (tables.byteClass(render[end]) & GrammarTables::CLASS_IDENTIFIER))
+            {
+                end++;
+            }
+
+            int kind = tables.keywords().lookup(render.substr(i, end - i));
+            if (kind != KeywordTable::KEYWORD_NONE &&
+                (end == n || (tables.byteClass(render[end]) & GrammarTables::CLASS_SEPARATOR)))
+            {
+                addRun(highlight, i, end - i, kind == KeywordTable::KEYWORD_SECONDARY ? HL_KEYWORD2 : HL_KEYWORD1);
+            }
+            i = end;
+            isPrevSeparator = false;
+            continue;
+        }
+
+        isPrevSeparator = cls & GrammarTables::CLASS_SEPARATOR;
+        i++;
+    }
+
+    return SyntaxCheckpoint{static_cast<std::uint32_t>(i), static_cast<std::int16_t>(region), isPrevSeparator,
+                            numberEnd == i};
+}
+
+
+} // namespace
+
+std::span<const EditorSyntax> syntaxDatabase()
+{
+    return HLDB;
+}
+
+bool isSeparator(int c)
+{
+    return GrammarTables::separator(c);
+}
+
+int syntaxHighlightLine(const EditorSyntax& syntax, std::string_view render, int startState, HighlightRuns& highlight)
+{
+    highlight.clear();
+    return syntaxEndState(syntax, highlightSpan(syntax, render, syntaxLineStart(startState), render.size(), highlight));
+}
+
+SyntaxCheckpoint syntaxLineStart(int startState)
+{
+    // the beginning of the line counts as a separator, otherwise numbers at
+    // the beginning of a line won't be highlighted
+    return SyntaxCheckpoint{0, static_cast<std::int16_t>(startState - 1), true, false};
+}
+
+void syntaxHighlightSpan(const EditorSyntax& syntax, std::string_view render, SyntaxCheckpoint& at, std::size_t until,
+                         HighlightRuns& highlight)
+{
+    at = highlightSpan(syntax, render, at, until, highlight);
+}
+
+int syntaxEndState(const EditorSyntax& syntax, const SyntaxCheckpoint& end)
+{
+    // single-line regions (line comments, most strings) end with the line
+    if (end.region >= 0 && syntax.tables->region(end.region).multiLine)
+        return end.region + 1;
+    return HL_STATE_NORMAL;
+}
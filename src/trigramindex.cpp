@@ -0,0 +1,204 @@
+#include "trigramindex.h"
+
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+
+namespace
+{
+
+constexpr std::size_t TRIGRAMS{1u << 24};
+// a trigram in more than one block out of this many is common
+constexpr std::size_t COMMON_RATIO{2};
+
+std::uint32_t trigram(std::string_view text, std::size_t at)
+{
+    return static_cast<unsigned char>(text[at]) << 16 | static_cast<unsigned char>(text[at + 1]) << 8 |
+           static_cast<unsigned char>(text[at + 2]);
+}
+
+void appendVarint(std::vector<std::uint8_t>& out, std::uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<std::uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<std::uint8_t>(value));
+}
+
+} // namespace
+
+std::unique_ptr<TrigramIndex> TrigramIndex::build(std::string_view data, const LineIndex& lines,
+                                                  const std::atomic<bool>& cancel)
+{
+    std::size_t blocks = (lines.size() + BLOCK_LINES - 1) / BLOCK_LINES;
+
+    // every trigram's place in postings plus one while building; a flat table
+    // is far cheaper than hashing for the lookups a large file takes
+    std::vector<std::uint32_t> slots(TRIGRAMS);
+    std::vector<std::uint32_t> keys;
+    std::vector<Postings> postings;
+    // trigrams already seen in the block, and the order they were seen in
+    std::vector<std::uint64_t> seen(TRIGRAMS / 64);
+    std::vector<std::uint32_t> found;
+
+    const auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+    for (std::size_t block{0}; block < blocks; ++block)
+    {
+        if (cancel.load(std::memory_order_relaxed))
+            return nullptr;
+
+        std::size_t first = block * BLOCK_LINES;
+        std::size_t last = std::min(first + BLOCK_LINES, lines.size());
+        const unsigned char* end = bytes + lines.start(last);
+
+        // matches never cross a line break, so neither do trigrams
+        std::uint32_t key{0};
+        int length{0};
+        found.clear();
+        for (const unsigned char* p = bytes + lines.start(first); p < end; ++p)
+        {
+            if (*p == '\n')
+            {
+                length = 0;
+                continue;
+            }
+            key = (key << 8 | *p) & (TRIGRAMS - 1);
+            if (++length < 3)
+                continue;
+
+            std::uint64_t bit = 1ull << (key % 64);
+            if (seen[key / 64] & bit)
+                continue;
+            seen[key / 64] |= bit;
+            found.push_back(key);
+        }
+
+        for (std::uint32_t key : found)
+        {
+            seen[key / 64] = 0;
+            std::uint32_t& slot = slots[key];
+            if (!slot)
+            {
+                keys.push_back(key);
+                postings.emplace_back();
+                slot = postings.size();
+            }
+            Postings& list = postings[slot - 1];
+            appendVarint(list.deltas, block - list.last);
+            list.last = block;
+            ++list.count;
+        }
+    }
+
+    auto index = std::make_unique<TrigramIndex>();
+    std::vector<std::uint32_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::ranges::sort(order, {}, [&](std::uint32_t i) { return keys[i]; });
+    index->m_keys.reserve(keys.size());
+    index->m_postings.reserve(keys.size());
+    for (std::uint32_t i : order)
+    {
+        Postings& list = postings[i];
+        if (list.count * COMMON_RATIO > blocks)
+        {
+            list.common = true;
+            std::vector<std::uint8_t>().swap(list.deltas);
+        }
+        list.deltas.shrink_to_fit();
+        index->m_keys.push_back(keys[i]);
+        index->m_postings.push_back(std::move(list));
+    }
+    return index;
+}
+
+std::vector<std::uint32_t> TrigramIndex::decode(const Postings& postings) const
+{
+    std::vector<std::uint32_t> blocks;
+    blocks.reserve(postings.count);
+    std::uint32_t block{0};
+    std::uint32_t delta{0};
+    int shift{0};
+    for (std::uint8_t byte : postings.deltas)
+    {
+        delta |= static_cast<std::uint32_t>(byte & 0x7f) << shift;
+        shift += 7;
+        if (byte & 0x80)
+            continue;
+        block += delta;
+        blocks.push_back(block);
+        delta = 0;
+        shift = 0;
+    }
+    return blocks;
+}
+
+std::optional<std::vector<std::uint32_t>> TrigramIndex::candidates(std::string_view query) const
+{
+    std::vector<const Postings*> lists;
+    for (std::size_t i{0}; i + 3 <= query.size(); ++i)
+    {
+        std::uint32_t key = trigram(query, i);
+        auto at = std::ranges::lower_bound(m_keys, key);
+        // a trigram that's nowhere in the file rules out every block
+        if (at == m_keys.end() || *at != key)
+            return std::vector<std::uint32_t>{};
+
+        const Postings& postings = m_postings[at - m_keys.begin()];
+        if (!postings.common)
+            lists.push_back(&postings);
+    }
+    if (lists.empty())
+        return std::nullopt;
+
+    // start from the shortest list, the others can only take blocks away
+    std::ranges::sort(lists, {}, [](const Postings* postings) { return postings->count; });
+    std::vector<std::uint32_t> blocks = decode(*lists.front());
+    std::vector<std::uint32_t> kept;
+    for (std::size_t i{1}; i < lists.size() && !blocks.empty(); ++i)
+    {
+        if (lists[i] == lists[i - 1])
+            continue;
+        kept.clear();
+        std::ranges::set_intersection(blocks, decode(*lists[i]), std::back_inserter(kept));
+        blocks.swap(kept);
+    }
+    return blocks;
+}
+
+std::size_t TrigramIndex::memoryUsage() const
+{
+    std::size_t bytes = m_keys.capacity() * sizeof(std::uint32_t) + m_postings.capacity() * sizeof(Postings);
+    for (const Postings& postings : m_postings)
+    {
+        bytes += postings.deltas.capacity();
+    }
+    return bytes;
+}
+
+TrigramIndexer::TrigramIndexer(std::string_view data, const LineIndex& lines, std::function<void()> notify)
+{
+    m_thread = std::thread{[this, data, &lines, notify = std::move(notify)] {
+        std::unique_ptr<TrigramIndex> index = TrigramIndex::build(data, lines, m_cancel);
+        if (!index)
+            return;
+        {
+            std::lock_guard lock{m_mutex};
+            m_index = std::move(index);
+        }
+        notify();
+    }};
+}
+
+TrigramIndexer::~TrigramIndexer()
+{
+    m_cancel = true;
+    m_thread.join();
+}
+
+std::unique_ptr<TrigramIndex> TrigramIndexer::take()
+{
+    std::lock_guard lock{m_mutex};
+    return std::move(m_index);
+}
@@ -0,0 +1,60 @@
+#include "wrapindex.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#include "parallel.h"
+
+namespace
+{
+
+// below this many lines a slice is not worth a thread
+constexpr std::size_t MIN_SLICE_LINES{1u << 16};
+// lines measured between checks for cancellation
+constexpr std::size_t CANCEL_INTERVAL{4096};
+
+} // namespace
+
+WrapIndexer::WrapIndexer(std::string_view data, const LineIndex& lines, Measure measure, std::function<void()> notify)
+{
+    m_thread = std::thread{[this, data, &lines, measure = std::move(measure), notify = std::move(notify)] {
+        std::size_t count = lines.size();
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        std::size_t sliceCount = std::clamp<std::size_t>(count / MIN_SLICE_LINES, 1, threads);
+
+        // each line's height goes after it, then they're summed in place
+        std::vector<std::uint32_t> totals(count + 1);
+        parallelFor(sliceCount, [&](unsigned i) {
+            std::size_t begin = count * i / sliceCount;
+            std::size_t end = count * (i + 1) / sliceCount;
+            for (std::size_t line{begin}; line < end; ++line)
+            {
+                if ((line - begin) % CANCEL_INTERVAL == 0 && m_cancel.load(std::memory_order_relaxed))
+                    return;
+                totals[line + 1] = measure(lines.line(data, line));
+            }
+        });
+        if (m_cancel.load(std::memory_order_relaxed))
+            return;
+        std::partial_sum(totals.begin(), totals.end(), totals.begin());
+
+        {
+            std::lock_guard lock{m_mutex};
+            m_totals = std::move(totals);
+        }
+        notify();
+    }};
+}
+
+WrapIndexer::~WrapIndexer()
+{
+    m_cancel = true;
+    m_thread.join();
+}
+
+std::optional<std::vector<std::uint32_t>> WrapIndexer::take()
+{
+    std::lock_guard lock{m_mutex};
+    return std::exchange(m_totals, std::nullopt);
+}
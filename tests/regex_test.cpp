@@ -0,0 +1,169 @@
+// Tests for the regex engine behind Ctrl-R searches and replaces.
+//
+//   regex-test
+//
+// Prints each failed check and exits nonzero when there was one.
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "regexmatcher.h"
+
+namespace
+{
+
+int failures{0};
+
+void check(bool ok, std::string_view what)
+{
+    if (!ok)
+    {
+        std::printf("FAIL: %.*s\n", static_cast<int>(what.size()), what.data());
+        ++failures;
+    }
+}
+
+std::shared_ptr<const Regex> compile(std::string_view pattern)
+{
+    std::string error;
+    auto regex = Regex::compile(pattern, error);
+    check(regex != nullptr, std::string{pattern} + " compiles: " + error);
+    return regex;
+}
+
+// the matches of pattern in line, as [start, end) pairs
+std::vector<std::pair<std::size_t, std::size_t>> find(std::string_view pattern, std::string_view line)
+{
+    std::vector<std::pair<std::size_t, std::size_t>> out;
+    auto regex = compile(pattern);
+    if (!regex)
+        return out;
+    RegexMatcher matcher{regex};
+    for (const RegexMatch& match : matcher.matches(line))
+    {
+        out.emplace_back(match.start, match.end);
+    }
+    // contains() and count() run a different pass and have to agree
+    check(matcher.contains(line) == !out.empty(), std::string{pattern} + " contains agrees with matches");
+    check(matcher.count(line) == out.size(), std::string{pattern} + " count agrees with matches");
+    return out;
+}
+
+void expect(std::string_view pattern, std::string_view line, std::vector<std::pair<std::size_t, std::size_t>> want)
+{
+    check(find(pattern, line) == want, std::string{pattern} + " on \"" + std::string{line} + "\"");
+}
+
+void expectLiteral(std::string_view pattern, std::string_view want)
+{
+    auto regex = compile(pattern);
+    check(regex && regex->literal() == want, std::string{pattern} + " has literal \"" + std::string{want} + "\"");
+}
+
+void expectInvalid(std::string_view pattern)
+{
+    std::string error;
+    check(!Regex::compile(pattern, error) && !error.empty(), std::string{pattern} + " is rejected");
+}
+
+void testLeftmostLongest()
+{
+    expect("a|ab", "xabx", {{1, 3}});
+    expect("ab|a", "xabx", {{1, 3}});
+    expect("(a|ab)(c|bcd)", "abcd", {{0, 4}});
+    expect("a+", "baaab", {{1, 4}});
+    expect("a*b", "aab ab b", {{0, 3}, {4, 6}, {7, 8}});
+    expect("x{2,3}", "xxxxx", {{0, 3}, {3, 5}});
+    expect("b", "abc", {{1, 2}});
+}
+
+void testNonOverlapping()
+{
+    expect("aa", "aaaaa", {{0, 2}, {2, 4}});
+    expect("aba", "ababababa", {{0, 3}, {4, 7}});
+    expect("timeout", "timeout timeouttimeout", {{0, 7}, {8, 15}, {15, 22}});
+}
+
+void testNoEmptyMatches()
+{
+    expect("a*", "bab", {{1, 2}});
+    expect("x?", "abc", {});
+    expect("a*", "", {});
+}
+
+void testAnchors()
+{
+    expect("^a", "aaa", {{0, 1}});
+    expect("a$", "aaa", {{2, 3}});
+    expect("^a+$", "aaa", {{0, 3}});
+    expect("^a+$", "aab", {});
+    expect("^b", "ab", {});
+    expect("b$", "ba", {});
+    expect("^ab|cd$", "ab cd ab cd", {{0, 2}, {9, 11}});
+}
+
+void testClasses()
+{
+    expect("[a-c]+", "xxabcabx", {{2, 7}});
+    expect("[^a]+", "aabba", {{2, 4}});
+    expect("\\d+", "id 4096, pid 7", {{3, 7}, {13, 14}});
+    expect("\\w+", "foo bar_1", {{0, 3}, {4, 9}});
+    expect("\\s", "a b\tc", {{1, 2}, {3, 4}});
+    expect("a.c", "abc a\tc", {{0, 3}, {4, 7}});
+}
+
+void testUtf8()
+{
+    // . and classes take whole characters, never part of one
+    expect(".", "é€", {{0, 2}, {2, 5}});
+    expect("x.x", "x€x x\xf0\x9f\x98\x80x", {{0, 5}, {6, 12}});
+    expect("[é€]+", "aé€b€", {{1, 6}, {7, 10}});
+    expect("[^a]", "a€", {{1, 4}});
+    expect("€+", "€€a€", {{0, 6}, {7, 10}});
+    expect("\\w", "é", {});
+}
+
+void testLiteral()
+{
+    expectLiteral("timeout", "timeout");
+    expectLiteral("ERROR.*timeout", "timeout");
+    expectLiteral("abc+d", "ab");
+    expectLiteral("(foo){2}", "foofoo");
+    expectLiteral("x(ab|ab)y", "xaby");
+    expectLiteral("foo|bar", "");
+    expectLiteral("a*", "");
+    expectLiteral("^start", "start");
+}
+
+void testInvalid()
+{
+    expectInvalid("(a");
+    expectInvalid("a)");
+    expectInvalid("[abc");
+    expectInvalid("*a");
+}
+
+} // namespace
+
+int main()
+{
+    testLeftmostLongest();
+    testNonOverlapping();
+    testNoEmptyMatches();
+    testAnchors();
+    testClasses();
+    testUtf8();
+    testLiteral();
+    testInvalid();
+    if (failures)
+    {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}